@@ -0,0 +1,36 @@
+#ifndef ALIGNED_H
+#define ALIGNED_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/// Standard allocator returning blocks aligned on ALIGNMENT bytes (a cache line by default),
+/// to be used with std::vector for arrays read by the hot loops.
+template <class T, std::size_t ALIGNMENT = 64>
+class AlignedAllocator {
+ public:
+  typedef T value_type;
+
+  template <class U> struct rebind { typedef AlignedAllocator<U, ALIGNMENT> other; };
+
+  AlignedAllocator () {}
+  template <class U> AlignedAllocator (const AlignedAllocator<U, ALIGNMENT> &) {}
+
+  T * allocate (std::size_t n) {
+    void * p = 0;
+    if (posix_memalign (&p, ALIGNMENT, n * sizeof (T)) != 0)
+      throw std::bad_alloc ();
+    return static_cast<T *> (p);
+  }
+
+  void deallocate (T * p, std::size_t) { free (p); }
+};
+
+template <class T, class U, std::size_t A>
+inline bool operator== (const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) { return true; }
+
+template <class T, class U, std::size_t A>
+inline bool operator!= (const AlignedAllocator<T, A> &, const AlignedAllocator<U, A> &) { return false; }
+
+#endif
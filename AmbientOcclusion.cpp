@@ -0,0 +1,78 @@
+#include "AmbientOcclusion.h"
+#include "Parallel.h"
+#include "Profiler.h"
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+  // Hash of (vertex, sample) to [0, 1), so that the samples do not depend on the
+  // thread evaluating them and successive passes never reuse a direction
+  inline float random01 (unsigned int vertex, unsigned int sample, unsigned int dimension) {
+    unsigned int h = vertex * 0x9E3779B1u ^ (sample * 0x85EBCA77u + dimension * 0xC2B2AE3Du);
+    h ^= h >> 16;
+    h *= 0x7FEB352Du;
+    h ^= h >> 15;
+    h *= 0x846CA68Bu;
+    h ^= h >> 16;
+    return (h >> 8) * (1.0f / 16777216.0f);
+  }
+}
+
+void AmbientOcclusion::reset (const Mesh & mesh) {
+  reset (mesh.numVertices ());
+}
+
+void AmbientOcclusion::reset (const CompactMesh & mesh) {
+  reset (mesh.numVertices ());
+}
+
+void AmbientOcclusion::reset (unsigned int numVertices) {
+  occluded.assign (numVertices, 0);
+  taken.assign (numVertices, 0);
+  passSamples = 0;
+}
+
+bool AmbientOcclusion::refine (const Mesh & mesh, const BVH & bvh) {
+  return refineMesh (mesh, bvh);
+}
+
+bool AmbientOcclusion::refine (const CompactMesh & mesh, const BVH & bvh) {
+  return refineMesh (mesh, bvh);
+}
+
+template <class MeshType>
+bool AmbientOcclusion::refineMesh (const MeshType & mesh, const BVH & bvh) {
+  if (occluded.size () != mesh.numVertices ())
+    reset (mesh.numVertices ());
+  if (converged ())
+    return false;
+  unsigned int first = passSamples;
+  unsigned int last = min (numSamples, passSamples + samplesPerPass);
+  parallelFor (mesh.numVertices (), 64, [&] (unsigned int begin, unsigned int end) {
+    PROFILE_ZONE ("ambient occlusion");
+    for (unsigned int i = begin; i < end; i++) {
+      const Vec3f & p = mesh.position (i);
+      Vec3f n = normalize (mesh.normal (i));
+      Vec3f u, w;
+      n.getTwoOrthogonals (u, w);
+      u.normalize ();
+      w.normalize ();
+      for (unsigned int s = first; s < last; s++) {
+        // Cosine-weighted direction around the normal
+        float phi = 2.0f * float (M_PI) * random01 (i, s, 0);
+        float r2 = random01 (i, s, 1);
+        float r = sqrt (r2);
+        Vec3f d = u * (r * cos (phi)) + w * (r * sin (phi)) + n * sqrt (1.0f - r2);
+        Vec3f target = p + d;
+        Ray ray (p[0], p[1], p[2], target[0], target[1], target[2]);
+        if (bvh.anyHit (ray, mesh, i, maxDistance))
+          occluded[i]++;
+        taken[i]++;
+      }
+    }
+  });
+  passSamples = last;
+  return true;
+}
@@ -0,0 +1,54 @@
+#ifndef AMBIENT_OCCLUSION_H
+#define AMBIENT_OCCLUSION_H
+
+#include <vector>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "BVH.h"
+#include "CompactMesh.h"
+
+/// Per-vertex ambient occlusion, estimated with cosine-weighted hemisphere rays
+/// traced through the BVH. Samples are accumulated progressively: each call to
+/// refine adds a few rays per vertex until numSamples is reached.
+class AmbientOcclusion {
+ public:
+  AmbientOcclusion () : numSamples (64), samplesPerPass (4), maxDistance (0.2f), passSamples (0) {}
+
+  /// Number of rays per vertex once converged
+  unsigned int numSamples;
+  /// Number of rays added per vertex by each call to refine
+  unsigned int samplesPerPass;
+  /// Occluders further than this distance (in unit mesh space) are ignored
+  float maxDistance;
+
+  /// Drops all the samples (to be called when the mesh or the parameters change)
+  void reset (const Mesh & mesh);
+  void reset (const CompactMesh & mesh);
+
+  /// Adds samplesPerPass rays to every vertex, in parallel. Returns false when
+  /// all the vertices already have numSamples samples.
+  bool refine (const Mesh & mesh, const BVH & bvh);
+  /// The same on a compact mesh, with a hierarchy built by BVH::build (const CompactMesh &)
+  bool refine (const CompactMesh & mesh, const BVH & bvh);
+
+  /// Fraction of unoccluded rays of vertex i (1 when no sample was taken yet)
+  inline float accessibility (unsigned int i) const {
+    return taken[i] > 0 ? 1.0f - float (occluded[i]) / float (taken[i]) : 1.0f;
+  }
+
+  inline bool converged () const { return passSamples >= numSamples; }
+
+  /// Samples taken so far by every vertex
+  inline unsigned int samples () const { return passSamples; }
+
+ private:
+  std::vector<unsigned int> occluded;
+  std::vector<unsigned int> taken;
+  unsigned int passSamples;
+
+  void reset (unsigned int numVertices);
+  template <class MeshType>
+  bool refineMesh (const MeshType & mesh, const BVH & bvh);
+};
+
+#endif
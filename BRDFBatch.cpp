@@ -0,0 +1,246 @@
+#include "BRDFBatch.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS
+#endif
+
+using namespace std;
+
+void ShadingBatch::build (const Vec3<float> * positions, const Vec3<float> * normals, unsigned int count,
+                          const Vec3<float> & light, const Vec3<float> & camera) {
+  for (unsigned int c = 0; c < 3; c++) {
+    n[c].resize (count);
+    l[c].resize (count);
+    v[c].resize (count);
+  }
+  for (unsigned int i = 0; i < count; i++) {
+    Vec3<float> ni = normalize (normals[i]);
+    Vec3<float> li = normalize (light - positions[i]);
+    Vec3<float> vi = normalize (camera - positions[i]);
+    for (unsigned int c = 0; c < 3; c++) {
+      n[c][i] = ni[c];
+      l[c][i] = li[c];
+      v[c][i] = vi[c];
+    }
+  }
+}
+
+BRDFInputs ShadingBatch::inputs () const {
+  BRDFInputs in;
+  for (unsigned int c = 0; c < 3; c++) {
+    in.n[c] = n[c].data ();
+    in.l[c] = l[c].data ();
+    in.v[c] = v[c].data ();
+  }
+  return in;
+}
+
+namespace {
+  namespace scalar {
+    struct Lanes {
+      typedef float Float;
+      static const unsigned int WIDTH = 1;
+      static inline Float load (const float * p) { return *p; }
+      static inline void store (float * p, Float a) { *p = a; }
+      static inline Float set (float a) { return a; }
+      static inline Float setZero () { return 0.0f; }
+      static inline Float sqrt (Float a) { return std::sqrt (a); }
+      /// a < b ? a : b and a > b ? a : b, as minps and maxps
+      static inline Float min (Float a, Float b) { return a < b ? a : b; }
+      static inline Float max (Float a, Float b) { return a > b ? a : b; }
+      /// a == 0 ? b : c
+      static inline Float selectZero (Float a, Float b, Float c) { return a == 0.0f ? b : c; }
+      static inline Float floor (Float a) { return std::floor (a); }
+      /// 2^i for the integers i in [-125, 127]
+      static inline Float exp2i (Float i) {
+        int bits = (int (i) + 127) << 23;
+        float r;
+        memcpy (&r, &bits, sizeof (r));
+        return r;
+      }
+      static inline Float exp (Float a) { return std::exp (a); }
+    };
+#include "BRDFBatchKernels.h"
+  }
+
+#ifdef HAS_X86_KERNELS
+  namespace sse2 {
+    struct Lanes {
+      typedef __m128 Float;
+      static const unsigned int WIDTH = 4;
+      static inline Float load (const float * p) { return _mm_loadu_ps (p); }
+      static inline void store (float * p, Float a) { _mm_storeu_ps (p, a); }
+      static inline Float set (float a) { return _mm_set1_ps (a); }
+      static inline Float setZero () { return _mm_setzero_ps (); }
+      static inline Float sqrt (Float a) { return _mm_sqrt_ps (a); }
+      static inline Float min (Float a, Float b) { return _mm_min_ps (a, b); }
+      static inline Float max (Float a, Float b) { return _mm_max_ps (a, b); }
+      static inline Float selectZero (Float a, Float b, Float c) {
+        __m128 zero = _mm_cmpeq_ps (a, _mm_setzero_ps ());
+        return _mm_or_ps (_mm_and_ps (zero, b), _mm_andnot_ps (zero, c));
+      }
+      static inline Float floor (Float a) {
+        __m128 i = _mm_cvtepi32_ps (_mm_cvttps_epi32 (a));
+        return _mm_sub_ps (i, _mm_and_ps (_mm_cmpgt_ps (i, a), _mm_set1_ps (1.0f)));
+      }
+      static inline Float exp2i (Float i) {
+        return _mm_castsi128_ps (_mm_slli_epi32 (_mm_add_epi32 (_mm_cvttps_epi32 (i), _mm_set1_epi32 (127)), 23));
+      }
+      static inline Float exp (Float a) {
+        alignas (16) float x[WIDTH];
+        _mm_store_ps (x, a);
+        for (unsigned int j = 0; j < WIDTH; j++)
+          x[j] = std::exp (x[j]);
+        return _mm_load_ps (x);
+      }
+    };
+#include "BRDFBatchKernels.h"
+  }
+
+#pragma GCC push_options
+#pragma GCC target ("avx2")
+  namespace avx2 {
+    struct Lanes {
+      typedef __m256 Float;
+      static const unsigned int WIDTH = 8;
+      static inline Float load (const float * p) { return _mm256_loadu_ps (p); }
+      static inline void store (float * p, Float a) { _mm256_storeu_ps (p, a); }
+      static inline Float set (float a) { return _mm256_set1_ps (a); }
+      static inline Float setZero () { return _mm256_setzero_ps (); }
+      static inline Float sqrt (Float a) { return _mm256_sqrt_ps (a); }
+      static inline Float min (Float a, Float b) { return _mm256_min_ps (a, b); }
+      static inline Float max (Float a, Float b) { return _mm256_max_ps (a, b); }
+      static inline Float selectZero (Float a, Float b, Float c) {
+        return _mm256_blendv_ps (c, b, _mm256_cmp_ps (a, _mm256_setzero_ps (), _CMP_EQ_OQ));
+      }
+      static inline Float floor (Float a) { return _mm256_floor_ps (a); }
+      static inline Float exp2i (Float i) {
+        return _mm256_castsi256_ps (_mm256_slli_epi32 (_mm256_add_epi32 (_mm256_cvttps_epi32 (i), _mm256_set1_epi32 (127)), 23));
+      }
+      static inline Float exp (Float a) {
+        alignas (32) float x[WIDTH];
+        _mm256_store_ps (x, a);
+        for (unsigned int j = 0; j < WIDTH; j++)
+          x[j] = std::exp (x[j]);
+        return _mm256_load_ps (x);
+      }
+    };
+#include "BRDFBatchKernels.h"
+  }
+#pragma GCC pop_options
+#endif
+
+  enum InstructionSet { SCALAR, SSE2, AVX2 };
+
+  InstructionSet detectInstructionSet () {
+#ifdef HAS_X86_KERNELS
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+      return AVX2;
+    return SSE2;
+#else
+    return SCALAR;
+#endif
+  }
+
+  const InstructionSet instructionSet = detectInstructionSet ();
+
+  /// Relative errors of the polynomials of degree 3, 4 and 5 of BRDFBatchKernels.h
+  /// over [0, 1) (measured on a million points)
+  const float EXP_ERRORS[3] = {7.5e-5f, 2.7e-6f, 1.6e-7f};
+
+  /// Lowest degree within maxRelativeError, 0 for the exact exp
+  int expDegree (float maxRelativeError) {
+    for (int degree = 3; degree <= 5; degree++)
+      if (EXP_ERRORS[degree - 3] <= maxRelativeError)
+        return degree;
+    return 0;
+  }
+
+  template <class BRDF, int EXP_DEGREE>
+  BRDFBatchFunction batchFunction () {
+    switch (instructionSet) {
+#ifdef HAS_X86_KERNELS
+    case AVX2:
+      return avx2::evaluateBatch<BRDF, EXP_DEGREE>;
+    case SSE2:
+      return sse2::evaluateBatch<BRDF, EXP_DEGREE>;
+#endif
+    default:
+      return scalar::evaluateBatch<BRDF, EXP_DEGREE>;
+    }
+  }
+
+  template <class BRDF, int EXP_DEGREE>
+  BRDFKernel rangeKernel () {
+    switch (instructionSet) {
+#ifdef HAS_X86_KERNELS
+    case AVX2:
+      return avx2::evaluateRange<BRDF, EXP_DEGREE>;
+    case SSE2:
+      return sse2::evaluateRange<BRDF, EXP_DEGREE>;
+#endif
+    default:
+      return scalar::evaluateRange<BRDF, EXP_DEGREE>;
+    }
+  }
+}
+
+BRDFBatchFunction brdfBatchFunction (int brdf, float maxRelativeError) {
+  switch (brdf) {
+  case BRDF_COOK_TORRANCE:
+    switch (expDegree (maxRelativeError)) {
+    case 3:
+      return batchFunction<CookTorrance, 3> ();
+    case 4:
+      return batchFunction<CookTorrance, 4> ();
+    case 5:
+      return batchFunction<CookTorrance, 5> ();
+    default:
+      return batchFunction<CookTorrance, 0> ();
+    }
+  case BRDF_GGX:
+    return batchFunction<GGX, 0> ();
+  default:
+    return batchFunction<BlinnPhong, 0> ();
+  }
+}
+
+BRDFKernel brdfBatchKernel (int brdf, float maxRelativeError) {
+  switch (brdf) {
+  case BRDF_COOK_TORRANCE:
+    switch (expDegree (maxRelativeError)) {
+    case 3:
+      return rangeKernel<CookTorrance, 3> ();
+    case 4:
+      return rangeKernel<CookTorrance, 4> ();
+    case 5:
+      return rangeKernel<CookTorrance, 5> ();
+    default:
+      return rangeKernel<CookTorrance, 0> ();
+    }
+  case BRDF_GGX:
+    return rangeKernel<GGX, 0> ();
+  default:
+    return rangeKernel<BlinnPhong, 0> ();
+  }
+}
+
+float batchExpError (float maxRelativeError) {
+  int degree = expDegree (maxRelativeError);
+  return degree ? EXP_ERRORS[degree - 3] : 0.0f;
+}
+
+const char * brdfBatchKernelName () {
+  switch (instructionSet) {
+  case AVX2:
+    return "avx2";
+  case SSE2:
+    return "sse2";
+  default:
+    return "scalar";
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef BRDF_BATCH_H
+#define BRDF_BATCH_H
+
+#include <vector>
+#include "Vec3.h"
+#include "Aligned.h"
+#include "Shading.h"
+
+/// Unit normals n, light directions l and view directions v of a set of points,
+/// as structure of arrays (the x, y and z arrays of each)
+struct BRDFInputs {
+  const float * n[3];
+  const float * l[3];
+  const float * v[3];
+};
+
+/// Storage of the BRDFInputs of the vertices of a mesh
+class ShadingBatch {
+ public:
+  typedef std::vector<float, AlignedAllocator<float> > FloatArray;
+
+  FloatArray n[3];
+  FloatArray l[3];
+  FloatArray v[3];
+
+  /// Normalized normals and directions from the positions to the light and the camera
+  void build (const Vec3<float> * positions, const Vec3<float> * normals, unsigned int count,
+              const Vec3<float> & light, const Vec3<float> & camera);
+
+  BRDFInputs inputs () const;
+  inline unsigned int size () const { return n[0].size (); }
+};
+
+/// Evaluates the BRDF (diffuse plus specular, weighted by the cosine with the
+/// light direction, as evaluateBRDF) of the points [0, count) of the inputs into out
+typedef void (*BRDFBatchFunction) (const BRDFInputs & inputs, unsigned int count, float * out);
+
+/// Batch kernel of one of the BRDF_*, with SIMD for this CPU (AVX2, SSE2 or
+/// scalar). The exponentials are approximated by polynomials within
+/// maxRelativeError of exp (plus |x| 2^-24 from the range reduction); with a
+/// bound below the best polynomial, exp is exact and the results are those of
+/// evaluateBRDF.
+BRDFBatchFunction brdfBatchFunction (int brdf, float maxRelativeError);
+
+/// The same kernel over vertex arrays, as a BRDFKernel: the directions are
+/// computed and normalized in blocks, then evaluated as a batch
+BRDFKernel brdfBatchKernel (int brdf, float maxRelativeError);
+
+/// Relative error bound of the exponential used for maxRelativeError (0 when exact)
+float batchExpError (float maxRelativeError);
+
+/// Instruction set of the batch kernels ("avx2", "sse2" or "scalar")
+const char * brdfBatchKernelName ();
+
+#endif
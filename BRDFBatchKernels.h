@@ -0,0 +1,164 @@
+// Batch BRDF kernels, written once for a Lanes type: a float or an SSE/AVX
+// register, with its loads, stores and the operations the operators do not
+// cover. BRDFBatch.cpp includes this file in one namespace per instruction set,
+// after defining Lanes, so that each copy is compiled for its target: there is
+// no include guard.
+//
+// The operations are those of the scalar BRDF policies of Shading.h, in the
+// same order and without fused multiply-add, so that with the exact exp the
+// results are the same bits as evaluateBRDF.
+
+typedef Lanes::Float Float;
+
+inline Float dot3 (const Float a[3], const Float b[3]) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+/// As Vec3::normalize: zero vectors are left unchanged
+inline void normalize3 (Float a[3]) {
+  Float l = Lanes::sqrt (dot3 (a, a));
+  Float invL = Lanes::selectZero (l, Lanes::set (1.0f), 1.0f / l);
+  a[0] *= invL;
+  a[1] *= invL;
+  a[2] *= invL;
+}
+
+/// exp (x), approximated by 2^floor (t) p (t - floor (t)) with t = x log2 (e)
+/// and p a polynomial of degree DEGREE, or exact for DEGREE 0. t is clamped to
+/// [-125, 127]: the results stay normal floats, denormals are very slow to multiply.
+template <int DEGREE>
+inline Float exp (Float x) {
+  if (DEGREE == 0)
+    return Lanes::exp (x);
+  Float t = Lanes::max (Lanes::min (x * 1.44269504f, Lanes::set (127.0f)), Lanes::set (-125.0f));
+  Float i = Lanes::floor (t);
+  Float f = t - i;
+  Float p;
+  // Minimax polynomials of 2^f over [0, 1)
+  if (DEGREE == 3)
+    p = ((7.8024521e-2f * f + 2.2606716e-1f) * f + 6.9583356e-1f) * f + 9.9992520e-1f;
+  else if (DEGREE == 4)
+    p = (((1.3534167e-2f * f + 5.2011464e-2f) * f + 2.4144275e-1f) * f + 6.9300383e-1f) * f + 1.0000026f;
+  else
+    p = ((((1.8775767e-3f * f + 8.9893397e-3f) * f + 5.5826318e-2f) * f + 2.4015361e-1f) * f
+         + 6.9315308e-1f) * f + 9.9999994e-1f;
+  return p * Lanes::exp2i (i);
+}
+
+/// Schlick's Fresnel term, as Schlick::fresnel
+template <class BRDF>
+inline Float fresnel (Float lh) {
+  Float x = 1.0f - Lanes::max (lh, Lanes::setZero ());
+  Float x2 = x * x;
+  return BRDF::F0 + (1.0f - BRDF::F0) * (x2 * x2 * x);
+}
+
+template <int EXP_DEGREE>
+inline Float specular (const BlinnPhong &, const Float n[3], const Float l[3], const Float v[3]) {
+  Float nl = dot3 (n, l);
+  Float r[3] = {2.0f * n[0] * nl - l[0], 2.0f * n[1] * nl - l[1], 2.0f * n[2] * nl - l[2]};
+  return BlinnPhong::KS * Lanes::sqrt (dot3 (r, v));
+}
+
+template <int EXP_DEGREE>
+inline Float specular (const CookTorrance &, const Float n[3], const Float l[3], const Float v[3]) {
+  const float ALPHA2 = CookTorrance::ALPHA2;
+  Float h[3] = {l[0] + v[0], l[1] + v[1], l[2] + v[2]};
+  normalize3 (h);
+  Float nh = dot3 (n, h), nl = dot3 (n, l), nv = dot3 (n, v), vh = dot3 (v, h);
+  Float nh2 = nh * nh;
+  Float D = exp<EXP_DEGREE> ((nh2 - 1.0f) / (ALPHA2 * nh2)) / (3.14f * ALPHA2 * nh2 * nh2);
+  // std::min (a, b) is b < a ? b : a, Lanes::min (b, a)
+  Float G = Lanes::min (2.0f * nh * nv / vh, Lanes::min (2.0f * nh * nl / vh, Lanes::set (1.0f)));
+  return D * fresnel<CookTorrance> (dot3 (l, h)) * G / (4.0f * nl * nv);
+}
+
+template <int EXP_DEGREE>
+inline Float specular (const GGX &, const Float n[3], const Float l[3], const Float v[3]) {
+  const float ALPHA2 = GGX::ALPHA2;
+  Float h[3] = {l[0] + v[0], l[1] + v[1], l[2] + v[2]};
+  normalize3 (h);
+  Float nh = dot3 (n, h), nl = dot3 (n, l), nv = dot3 (n, v);
+  Float d = 1.0f + (ALPHA2 - 1.0f) * nh * nh;
+  Float D = ALPHA2 / 3.14f / (d * d);
+  Float Gi = 2.0f * nl / (nl + Lanes::sqrt (ALPHA2 + (1.0f - ALPHA2) * nl * nl))
+    / (nv + Lanes::sqrt (ALPHA2 + (1.0f - ALPHA2) * nv * nv));
+  Float Go = 2.0f * nv;
+  return D * fresnel<GGX> (dot3 (l, h)) * Gi * Go / (4.0f * nl * nv);
+}
+
+/// Lanes::WIDTH points from the index i of the inputs
+template <class BRDF, int EXP_DEGREE>
+inline Float evaluate (const BRDFInputs & in, unsigned int i) {
+  Float n[3] = {Lanes::load (in.n[0] + i), Lanes::load (in.n[1] + i), Lanes::load (in.n[2] + i)};
+  Float l[3] = {Lanes::load (in.l[0] + i), Lanes::load (in.l[1] + i), Lanes::load (in.l[2] + i)};
+  Float v[3] = {Lanes::load (in.v[0] + i), Lanes::load (in.v[1] + i), Lanes::load (in.v[2] + i)};
+  return (Lambert::KD_OVER_PI + specular<EXP_DEGREE> (BRDF (), n, l, v)) * dot3 (n, l);
+}
+
+template <class BRDF, int EXP_DEGREE>
+void evaluateBatch (const BRDFInputs & in, unsigned int count, float * out) {
+  const unsigned int WIDTH = Lanes::WIDTH;
+  unsigned int i = 0;
+  for (; i + WIDTH <= count; i += WIDTH)
+    Lanes::store (out + i, evaluate<BRDF, EXP_DEGREE> (in, i));
+  if (i == count)
+    return;
+
+  // Last points, copied to a full register of zero padded inputs
+  float tail[10][WIDTH] = {};
+  BRDFInputs padded;
+  for (unsigned int c = 0; c < 3; c++) {
+    padded.n[c] = tail[c];
+    padded.l[c] = tail[3 + c];
+    padded.v[c] = tail[6 + c];
+    for (unsigned int j = i; j < count; j++) {
+      tail[c][j - i] = in.n[c][j];
+      tail[3 + c][j - i] = in.l[c][j];
+      tail[6 + c][j - i] = in.v[c][j];
+    }
+  }
+  Lanes::store (tail[9], evaluate<BRDF, EXP_DEGREE> (padded, 0));
+  for (unsigned int j = i; j < count; j++)
+    out[j] = tail[9][j - i];
+}
+
+/// BRDFKernel over vertex arrays: blocks of directions as in evaluateBRDF,
+/// normalized with the lanes, then evaluated by evaluateBatch
+template <class BRDF, int EXP_DEGREE>
+void evaluateRange (const Vec3<float> * positions, const Vec3<float> * normals,
+                    const Vec3<float> & light, const Vec3<float> & camera,
+                    unsigned int begin, unsigned int end, float * out) {
+  const unsigned int BLOCK = 256;
+  alignas (64) float block[9][BLOCK];
+  BRDFInputs in;
+  for (unsigned int c = 0; c < 3; c++) {
+    in.n[c] = block[c];
+    in.l[c] = block[3 + c];
+    in.v[c] = block[6 + c];
+  }
+  for (unsigned int first = begin; first < end; first += BLOCK) {
+    unsigned int count = std::min (BLOCK, end - first);
+    for (unsigned int k = 0; k < count; k++) {
+      const Vec3<float> & p = positions[first + k];
+      const Vec3<float> & n = normals[first + k];
+      for (unsigned int c = 0; c < 3; c++) {
+        block[c][k] = n[c];
+        block[3 + c][k] = light[c] - p[c];
+        block[6 + c][k] = camera[c] - p[c];
+      }
+    }
+    unsigned int padded = (count + Lanes::WIDTH - 1) / Lanes::WIDTH * Lanes::WIDTH;
+    for (unsigned int k = count; k < padded; k++)
+      for (unsigned int c = 0; c < 9; c++)
+        block[c][k] = 0.0f;
+    for (unsigned int k = 0; k < padded; k += Lanes::WIDTH)
+      for (unsigned int c = 0; c < 9; c += 3) {
+        Float a[3] = {Lanes::load (block[c] + k), Lanes::load (block[c + 1] + k), Lanes::load (block[c + 2] + k)};
+        normalize3 (a);
+        for (unsigned int d = 0; d < 3; d++)
+          Lanes::store (block[c + d] + k, a[d]);
+      }
+    evaluateBatch<BRDF, EXP_DEGREE> (in, count, out + first);
+  }
+}
@@ -0,0 +1,101 @@
+#include "BRDFTable.h"
+#include "Shading.h"
+#include "Profiler.h"
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  /// Samples f at the cosines i / (SIZE - 1), plus a copy of the last sample for lookup
+  template <class Function>
+  void tabulate (BRDFTable::Table & table, Function f) {
+    table.resize (BRDFTable::SIZE + 1);
+    for (unsigned int i = 0; i < BRDFTable::SIZE; i++) {
+      float value = f (i / float (BRDFTable::SIZE - 1));
+      // The Beckmann distribution is 0 / 0 at N.H = 0, its limit is 0
+      table[i] = std::isfinite (value) ? value : 0.0f;
+    }
+    table[BRDFTable::SIZE] = table[BRDFTable::SIZE - 1];
+  }
+
+  /// Geometric term divided by 4 N.L N.V
+  inline float geometry (const CookTorrance &, const BRDFTable &, float nh, float nl, float nv, float vh) {
+    return min (min (1.0f, 2.0f * nh * nl / vh), 2.0f * nh * nv / vh) / (4.0f * nl * nv);
+  }
+
+  inline float geometry (const GGX &, const BRDFTable & table, float, float nl, float nv, float) {
+    return BRDFTable::lookup (table.G, nl) * BRDFTable::lookup (table.G, nv);
+  }
+
+  template <class BRDF>
+  inline float evaluateTabulated (const BRDFTable & table, const Vec3<float> & p, const Vec3<float> & n,
+                                  const Vec3<float> & light, const Vec3<float> & camera) {
+    Vec3<float> nn = normalize (n);
+    Vec3<float> l = normalize (light - p);
+    Vec3<float> v = normalize (camera - p);
+    Vec3<float> h = normalize (l + v);
+    float nh = dot (nn, h), nl = dot (nn, l), nv = dot (nn, v), vh = dot (v, h);
+    float specular = BRDFTable::lookup (table.D, nh) * BRDFTable::lookup (table.F, dot (l, h))
+      * geometry (BRDF (), table, nh, nl, nv, vh);
+    return (Lambert::KD_OVER_PI + specular) * nl;
+  }
+
+  template <class BRDF>
+  void evaluateTabulatedRange (const BRDFTable & table, const Vec3<float> * positions, const Vec3<float> * normals,
+                               const Vec3<float> & light, const Vec3<float> & camera,
+                               unsigned int begin, unsigned int end, float * out) {
+    for (unsigned int i = begin; i < end; i++)
+      out[i] = evaluateTabulated<BRDF> (table, positions[i], normals[i], light, camera);
+  }
+}
+
+bool BRDFTable::build (int brdf) {
+  PROFILE_ZONE ("BRDFTable::build");
+  material = brdf;
+  switch (brdf) {
+  case BRDF_COOK_TORRANCE:
+    tabulate (D, CookTorrance::distribution);
+    tabulate (F, CookTorrance::fresnel);
+    G.clear ();
+    return true;
+  case BRDF_GGX:
+    tabulate (D, GGX::distribution);
+    tabulate (F, GGX::fresnel);
+    tabulate (G, GGX::visibility);
+    return true;
+  default:
+    D.clear ();
+    F.clear ();
+    G.clear ();
+    return false;
+  }
+}
+
+float BRDFTable::evaluate (const Vec3<float> & p, const Vec3<float> & n,
+                           const Vec3<float> & light, const Vec3<float> & camera) const {
+  switch (material) {
+  case BRDF_COOK_TORRANCE:
+    return evaluateTabulated<CookTorrance> (*this, p, n, light, camera);
+  case BRDF_GGX:
+    return evaluateTabulated<GGX> (*this, p, n, light, camera);
+  default:
+    return evaluateBRDF<BlinnPhong> (p, n, light, camera);
+  }
+}
+
+void BRDFTable::evaluateRange (const Vec3<float> * positions, const Vec3<float> * normals,
+                               const Vec3<float> & light, const Vec3<float> & camera,
+                               unsigned int begin, unsigned int end, float * out) const {
+  switch (material) {
+  case BRDF_COOK_TORRANCE:
+    evaluateTabulatedRange<CookTorrance> (*this, positions, normals, light, camera, begin, end, out);
+    break;
+  case BRDF_GGX:
+    evaluateTabulatedRange<GGX> (*this, positions, normals, light, camera, begin, end, out);
+    break;
+  default:
+    brdfKernel (BRDF_BLINN_PHONG) (positions, normals, light, camera, begin, end, out);
+    break;
+  }
+}
@@ -0,0 +1,52 @@
+#ifndef BRDF_TABLE_H
+#define BRDF_TABLE_H
+
+#include <vector>
+#include "Vec3.h"
+
+/// Lookup tables of the microfacet terms of a material (BRDF_COOK_TORRANCE or
+/// BRDF_GGX), built once when the material is chosen: the distribution over
+/// N.H, the Fresnel term over L.H and, for GGX, the geometric term over N.L
+/// and N.V. The tables sample the cosines over [0, 1] and are linearly
+/// interpolated. The geometric term of Cook-Torrance also depends on V.H and
+/// has no transcendental: it stays analytic.
+class BRDFTable {
+ public:
+  static const unsigned int SIZE = 1024;
+
+  typedef std::vector<float> Table;
+
+  Table D;   // distribution, over N.H
+  Table F;   // Fresnel term, over L.H
+  Table G;   // GGX only: G / (4 N.L N.V) = G (N.L) G (N.V)
+
+  BRDFTable () : material (-1) {}
+
+  /// Tabulates the terms of one of the BRDF_*, returns false if it has none (Blinn-Phong)
+  bool build (int brdf);
+
+  /// BRDF_* of the tables, -1 before build
+  inline int brdf () const { return material; }
+
+  /// Linear interpolation of a table at the cosine x, clamped to [0, 1]
+  static inline float lookup (const Table & table, float x) {
+    float s = (x > 0.0f ? (x < 1.0f ? x : 1.0f) : 0.0f) * (SIZE - 1);
+    unsigned int i = (unsigned int) s;
+    float t = s - i;
+    return table[i] + t * (table[i + 1] - table[i]);
+  }
+
+  /// evaluateBRDF with the tabulated terms
+  float evaluate (const Vec3<float> & p, const Vec3<float> & n,
+                  const Vec3<float> & light, const Vec3<float> & camera) const;
+
+  /// The same for the vertices [begin, end) of the arrays, as a BRDFKernel
+  void evaluateRange (const Vec3<float> * positions, const Vec3<float> * normals,
+                      const Vec3<float> & light, const Vec3<float> & camera,
+                      unsigned int begin, unsigned int end, float * out) const;
+
+ private:
+  int material;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "BSH.h"
+#include "Profiler.h"
+#include "RayStats.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  // Orders triangle indices along one axis of their centroids
+  class CentroidLess {
+   public:
+    CentroidLess (const vector<Vec3<float> > & c, int axis) : c (c), axis (axis) {}
+    bool operator() (unsigned int a, unsigned int b) const { return c[a][axis] < c[b][axis]; }
+   private:
+    const vector<Vec3<float> > & c;
+    int axis;
+  };
+}
+
+void BSH::build (const Mesh & mesh) {
+  PROFILE_ZONE ("BSH::build");
+  nodes.clear ();
+  triangles.resize (mesh.T.size ());
+  if (mesh.T.empty ())
+    return;
+  vector<Vec3<float> > centroids (mesh.T.size ());
+  for (unsigned int i = 0; i < mesh.T.size (); i++) {
+    triangles[i] = i;
+    centroids[i] = (mesh.positions[mesh.T[i].v[0]] + mesh.positions[mesh.T[i].v[1]] + mesh.positions[mesh.T[i].v[2]]) / 3.0f;
+  }
+  nodes.reserve (2 * mesh.T.size () / LEAF_SIZE + 1);
+  buildNode (mesh, centroids, 0, mesh.T.size ());
+}
+
+unsigned int BSH::buildNode (const Mesh & mesh, const vector<Vec3<float> > & centroids,
+                             unsigned int first, unsigned int count) {
+  // Bounding box of the vertices of the node, its center is the sphere center
+  Vec3<float> bmin = mesh.positions[mesh.T[triangles[first]].v[0]];
+  Vec3<float> bmax = bmin;
+  Vec3<float> cmin = centroids[triangles[first]];
+  Vec3<float> cmax = cmin;
+  for (unsigned int i = first; i < first + count; i++) {
+    for (unsigned int j = 0; j < 3; j++) {
+      const Vec3<float> & p = mesh.positions[mesh.T[triangles[i]].v[j]];
+      for (int k = 0; k < 3; k++) {
+        bmin[k] = min (bmin[k], p[k]);
+        bmax[k] = max (bmax[k], p[k]);
+      }
+    }
+    const Vec3<float> & c = centroids[triangles[i]];
+    for (int k = 0; k < 3; k++) {
+      cmin[k] = min (cmin[k], c[k]);
+      cmax[k] = max (cmax[k], c[k]);
+    }
+  }
+
+  BSHNode node;
+  node.center = (bmin + bmax) / 2.0f;
+  node.radius = 0.0f;
+  for (unsigned int i = first; i < first + count; i++)
+    for (unsigned int j = 0; j < 3; j++)
+      node.radius = max (node.radius, dist (node.center, mesh.positions[mesh.T[triangles[i]].v[j]]));
+  // Slightly inflated so that rays starting on a vertex of the node are not culled by rounding
+  node.radius *= 1.0001f;
+  node.left = node.right = 0;
+  node.first = first;
+  node.count = count;
+
+  unsigned int index = nodes.size ();
+  nodes.push_back (node);
+  if (count <= LEAF_SIZE)
+    return index;
+
+  // Median split along the largest extent of the centroids
+  Vec3<float> extent = cmax - cmin;
+  int axis = 0;
+  if (extent[1] > extent[axis]) axis = 1;
+  if (extent[2] > extent[axis]) axis = 2;
+  unsigned int half = count / 2;
+  nth_element (triangles.begin () + first, triangles.begin () + first + half,
+               triangles.begin () + first + count, CentroidLess (centroids, axis));
+
+  unsigned int left = buildNode (mesh, centroids, first, half);
+  unsigned int right = buildNode (mesh, centroids, first + half, count - half);
+  nodes[index].left = left;
+  nodes[index].right = right;
+  nodes[index].count = 0;
+  return index;
+}
+
+int BSH::intersect (Ray & ray, const Mesh & mesh, unsigned int source) const {
+  if (nodes.empty ())
+    return 0;
+  RayQuery query;
+  unsigned int stack[64];
+  unsigned int stackSize = 0;
+  stack[stackSize++] = 0;
+  while (stackSize > 0) {
+    const BSHNode & node = nodes[stack[--stackSize]];
+    query.nodesVisited++;
+    if (!ray.intersectSphere (node.center, node.radius)) {
+      query.earlyOuts++;
+      continue;
+    }
+    if (node.count > 0) {
+      for (unsigned int i = node.first; i < node.first + node.count; i++) {
+        const TriangleRecord & tri = mesh.records[triangles[i]];
+        if (tri.contains (source))
+          continue;
+        query.triangleTests++;
+        if (ray.intersect (tri)) {
+          query.hit = 1;
+          return 1;
+        }
+      }
+    } else {
+      stack[stackSize++] = node.right;
+      stack[stackSize++] = node.left;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,39 @@
+#ifndef BSH_H
+#define BSH_H
+
+#include <vector>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "Ray.h"
+
+/// A node of the bounding sphere hierarchy. Internal nodes point to their two
+/// children, leaves point to a range of BSH::triangles.
+class BSHNode {
+ public:
+  Vec3<float> center;
+  float radius;
+  unsigned int left, right;
+  unsigned int first, count; // count == 0 for internal nodes
+};
+
+/// Bounding sphere hierarchy over the triangles of a mesh, used to cull the
+/// shadow ray tests.
+class BSH {
+ public:
+  std::vector<BSHNode> nodes;
+  std::vector<unsigned int> triangles;
+
+  /// Builds the hierarchy over mesh.T (to be called after Mesh::loadOFF)
+  void build (const Mesh & mesh);
+
+  /// Returns 1 if the ray hits a triangle of the mesh. The ray starts on the
+  /// vertex 'source' (or NO_VERTEX), whose incident triangles are not tested.
+  int intersect (Ray & ray, const Mesh & mesh, unsigned int source) const;
+
+ private:
+  static const unsigned int LEAF_SIZE = 4;
+  unsigned int buildNode (const Mesh & mesh, const std::vector<Vec3<float> > & centroids,
+                          unsigned int first, unsigned int count);
+};
+
+#endif
@@ -0,0 +1,402 @@
+#include "BVH.h"
+#include "Profiler.h"
+#include "RayStats.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  inline float halfArea (const Vec3<float> & bmin, const Vec3<float> & bmax) {
+    Vec3<float> e = bmax - bmin;
+    return e[0] * e[1] + e[1] * e[2] + e[2] * e[0];
+  }
+
+  inline void grow (Vec3<float> & bmin, Vec3<float> & bmax, const Vec3<float> & p) {
+    bmin = componentMin (bmin, p);
+    bmax = componentMax (bmax, p);
+  }
+
+  // Binning of the triangle centroids along one axis
+  class BinOf {
+   public:
+    BinOf (int axis, float cmin, float scale, unsigned int numBins)
+      : axis (axis), cmin (cmin), scale (scale), numBins (numBins) {}
+    unsigned int operator() (const Vec3<float> & c) const {
+      int b = int ((c[axis] - cmin) * scale);
+      return min ((unsigned int) max (b, 0), numBins - 1);
+    }
+   private:
+    int axis;
+    float cmin, scale;
+    unsigned int numBins;
+  };
+
+  // Slab test, returns the entry distance or a negative value when the box is missed
+  inline float hitBox (const BVHNode & n, const float o[3], const float inv[3], float tMax) {
+    float tmin = 0.0f;
+    for (int k = 0; k < 3; k++) {
+      float t0 = (n.bmin[k] - o[k]) * inv[k];
+      float t1 = (n.bmax[k] - o[k]) * inv[k];
+      if (t0 > t1) swap (t0, t1);
+      tmin = max (tmin, t0);
+      tMax = min (tMax, t1);
+    }
+    return tmin <= tMax ? tmin : -1.0f;
+  }
+
+  // True for the triangles whose centroid falls on the left of the split plane
+  class LeftOfSplit {
+   public:
+    LeftOfSplit (const BinOf & binOf, const vector<Vec3<float> > & centroids, unsigned int split)
+      : binOf (binOf), centroids (centroids), split (split) {}
+    bool operator() (unsigned int t) const { return binOf (centroids[t]) <= split; }
+   private:
+    BinOf binOf;
+    const vector<Vec3<float> > & centroids;
+    unsigned int split;
+  };
+
+  inline void setupRay (const Ray & ray, float o[3], float inv[3]) {
+    for (int k = 0; k < 3; k++) {
+      o[k] = ray.origin[k];
+      inv[k] = 1.0f / (ray.direction[k] != 0.0f ? ray.direction[k] : 1e-30f);
+    }
+  }
+}
+
+void BVH::build (const Mesh & mesh) {
+  PROFILE_ZONE ("BVH::build");
+  vector<Vec3<float> > bmins (mesh.T.size ()), bmaxs (mesh.T.size ());
+  for (unsigned int i = 0; i < mesh.T.size (); i++) {
+    bmins[i] = bmaxs[i] = mesh.positions[mesh.T[i].v[0]];
+    grow (bmins[i], bmaxs[i], mesh.positions[mesh.T[i].v[1]]);
+    grow (bmins[i], bmaxs[i], mesh.positions[mesh.T[i].v[2]]);
+  }
+  buildFromBoxes (bmins, bmaxs);
+  updateTriangleData (mesh);
+}
+
+void BVH::build (const CompactMesh & mesh) {
+  PROFILE_ZONE ("BVH::build compact");
+  vector<Vec3<float> > bmins (mesh.numTriangles ()), bmaxs (mesh.numTriangles ());
+  for (unsigned int i = 0; i < mesh.numTriangles (); i++) {
+    unsigned int v[3];
+    mesh.triangle (i, v);
+    bmins[i] = bmaxs[i] = mesh.position (v[0]);
+    grow (bmins[i], bmaxs[i], mesh.position (v[1]));
+    grow (bmins[i], bmaxs[i], mesh.position (v[2]));
+  }
+  buildFromBoxes (bmins, bmaxs);
+  packets = TriangleSoA ();
+}
+
+void BVH::buildFromBoxes (const vector<Vec3<float> > & bmins, const vector<Vec3<float> > & bmaxs) {
+  unsigned int numTriangles = bmins.size ();
+  nodes.clear ();
+  triangles.resize (numTriangles);
+  if (numTriangles == 0)
+    return;
+  vector<Vec3<float> > centroids (numTriangles);
+  for (unsigned int i = 0; i < numTriangles; i++) {
+    triangles[i] = i;
+    centroids[i] = (bmins[i] + bmaxs[i]) / 2.0f;
+  }
+  nodes.reserve (2 * numTriangles);
+  buildNode (bmins, bmaxs, centroids, 0, numTriangles, 0);
+  nodes.shrink_to_fit ();
+}
+
+void BVH::updateTriangleData (const Mesh & mesh) {
+  packets.build (mesh, triangles);
+}
+
+bool BVH::valid (unsigned int numTriangles) const {
+  for (unsigned int i = 0; i < triangles.size (); i++)
+    if (triangles[i] >= numTriangles)
+      return false;
+  // The children follow their parent, so the depths are known in array order
+  vector<unsigned int> depth (nodes.size (), 0);
+  for (unsigned int i = 0; i < nodes.size (); i++) {
+    const BVHNode & node = nodes[i];
+    if (depth[i] >= MAX_DEPTH)
+      return false;
+    if (node.count > 0) {
+      if (node.count > triangles.size () || node.offset > triangles.size () - node.count)
+        return false;
+    } else {
+      if (i + 1 >= nodes.size () || node.offset <= i + 1 || node.offset >= nodes.size ())
+        return false;
+      depth[i + 1] = max (depth[i + 1], depth[i] + 1);
+      depth[node.offset] = max (depth[node.offset], depth[i] + 1);
+    }
+  }
+  return true;
+}
+
+void BVH::buildNode (const vector<Vec3<float> > & bmins, const vector<Vec3<float> > & bmaxs,
+                     const vector<Vec3<float> > & centroids,
+                     unsigned int first, unsigned int count, unsigned int depth) {
+  Vec3<float> bmin = bmins[triangles[first]], bmax = bmaxs[triangles[first]];
+  Vec3<float> cmin = centroids[triangles[first]], cmax = cmin;
+  for (unsigned int i = first; i < first + count; i++) {
+    grow (bmin, bmax, bmins[triangles[i]]);
+    grow (bmin, bmax, bmaxs[triangles[i]]);
+    grow (cmin, cmax, centroids[triangles[i]]);
+  }
+
+  unsigned int index = nodes.size ();
+  BVHNode node;
+  for (int k = 0; k < 3; k++) {
+    node.bmin[k] = bmin[k];
+    node.bmax[k] = bmax[k];
+  }
+  node.offset = first;
+  node.count = count;
+  nodes.push_back (node);
+  if (count <= 2 || depth + 1 >= MAX_DEPTH)
+    return;
+
+  // Binned SAH: evaluate the NUM_BINS - 1 candidate planes of each axis
+  int bestAxis = -1;
+  unsigned int bestSplit = 0;
+  float bestCost = 1e30f;
+  for (int axis = 0; axis < 3; axis++) {
+    float extent = cmax[axis] - cmin[axis];
+    if (extent <= 0.0f)
+      continue;
+    BinOf binOf (axis, cmin[axis], NUM_BINS / extent, NUM_BINS);
+    unsigned int binCount[NUM_BINS] = {0};
+    Vec3<float> binMin[NUM_BINS], binMax[NUM_BINS];
+    for (unsigned int b = 0; b < NUM_BINS; b++) {
+      binMin[b] = Vec3<float> (1e30f, 1e30f, 1e30f);
+      binMax[b] = Vec3<float> (-1e30f, -1e30f, -1e30f);
+    }
+    for (unsigned int i = first; i < first + count; i++) {
+      unsigned int b = binOf (centroids[triangles[i]]);
+      binCount[b]++;
+      grow (binMin[b], binMax[b], bmins[triangles[i]]);
+      grow (binMin[b], binMax[b], bmaxs[triangles[i]]);
+    }
+    // Sweep from the right to get the cost of the right sides, then from the left
+    float rightCost[NUM_BINS];
+    Vec3<float> rmin = binMin[NUM_BINS - 1], rmax = binMax[NUM_BINS - 1];
+    unsigned int rcount = 0;
+    for (unsigned int b = NUM_BINS - 1; b > 0; b--) {
+      grow (rmin, rmax, binMin[b]);
+      grow (rmin, rmax, binMax[b]);
+      rcount += binCount[b];
+      rightCost[b] = rcount > 0 ? rcount * halfArea (rmin, rmax) : 0.0f;
+    }
+    Vec3<float> lmin = binMin[0], lmax = binMax[0];
+    unsigned int lcount = 0;
+    for (unsigned int b = 0; b < NUM_BINS - 1; b++) {
+      grow (lmin, lmax, binMin[b]);
+      grow (lmin, lmax, binMax[b]);
+      lcount += binCount[b];
+      if (lcount == 0 || lcount == count)
+        continue;
+      float cost = lcount * halfArea (lmin, lmax) + rightCost[b + 1];
+      if (cost < bestCost) {
+        bestCost = cost;
+        bestAxis = axis;
+        bestSplit = b;
+      }
+    }
+  }
+
+  // Keep a leaf when splitting is not worth it (traversal step costs as much as one triangle test)
+  float leafCost = count;
+  float splitCost = 1.0f + bestCost / halfArea (bmin, bmax);
+  if (count <= MAX_LEAF_SIZE && (bestAxis < 0 || splitCost >= leafCost))
+    return;
+
+  unsigned int half;
+  if (bestAxis >= 0) {
+    BinOf binOf (bestAxis, cmin[bestAxis], NUM_BINS / (cmax[bestAxis] - cmin[bestAxis]), NUM_BINS);
+    vector<unsigned int>::iterator middle = partition (triangles.begin () + first, triangles.begin () + first + count,
+                                                       LeftOfSplit (binOf, centroids, bestSplit));
+    half = middle - (triangles.begin () + first);
+  } else {
+    // All the centroids are at the same place, split the list in two
+    half = count / 2;
+  }
+
+  nodes[index].count = 0;
+  buildNode (bmins, bmaxs, centroids, first, half, depth + 1);
+  nodes[index].offset = nodes.size ();
+  buildNode (bmins, bmaxs, centroids, first + half, count - half, depth + 1);
+}
+
+template <class LeafTest>
+int BVH::anyHitTraversal (Ray & ray, float tMax, LeafTest leafHit) const {
+  if (nodes.empty ())
+    return 0;
+  RayQuery query;
+  float o[3], inv[3];
+  setupRay (ray, o, inv);
+  unsigned int stack[MAX_DEPTH];
+  unsigned int stackSize = 0;
+  unsigned int current = 0;
+  query.nodesVisited++;
+  if (hitBox (nodes[0], o, inv, tMax) < 0.0f) {
+    query.earlyOuts++;
+    return 0;
+  }
+  while (true) {
+    const BVHNode & node = nodes[current];
+    if (node.count > 0) {
+      query.triangleTests += node.count;
+      if (leafHit (node.offset, node.count)) {
+        query.hit = 1;
+        return 1;
+      }
+    } else {
+      float tl = hitBox (nodes[current + 1], o, inv, tMax);
+      float tr = hitBox (nodes[node.offset], o, inv, tMax);
+      query.nodesVisited += 2;
+      query.earlyOuts += (tl < 0.0f) + (tr < 0.0f);
+      if (tl >= 0.0f && tr >= 0.0f) {
+        stack[stackSize++] = node.offset;
+        current = current + 1;
+        continue;
+      }
+      if (tl >= 0.0f) {
+        current = current + 1;
+        continue;
+      }
+      if (tr >= 0.0f) {
+        current = node.offset;
+        continue;
+      }
+    }
+    if (stackSize == 0)
+      return 0;
+    current = stack[--stackSize];
+  }
+}
+
+int BVH::anyHit (Ray & ray, const Mesh &, unsigned int source, float tMax) const {
+  return anyHitTraversal (ray, tMax, [&] (unsigned int first, unsigned int count) {
+    for (unsigned int i = first; i < first + count; i += TriangleSoA::PACKET_SIZE) {
+      float t[TriangleSoA::PACKET_SIZE];
+      unsigned int n = min (TriangleSoA::PACKET_SIZE, first + count - i);
+      unsigned int hits = intersectPacket (packets, i, n, ray, source, t);
+      for (unsigned int j = 0; hits != 0; j++, hits >>= 1)
+        if ((hits & 1) && t[j] <= tMax)
+          return true;
+    }
+    return false;
+  });
+}
+
+int BVH::anyHit (Ray & ray, const CompactMesh & mesh, unsigned int source, float tMax) const {
+  return anyHitTraversal (ray, tMax, [&] (unsigned int first, unsigned int count) {
+    for (unsigned int i = first; i < first + count; i++) {
+      unsigned int v[3];
+      mesh.triangle (triangles[i], v);
+      if (v[0] == source || v[1] == source || v[2] == source)
+        continue;
+      float t;
+      if (ray.intersect (mesh.position (v[0]), mesh.position (v[1]), mesh.position (v[2]), t) && t <= tMax)
+        return true;
+    }
+    return false;
+  });
+}
+
+template <class LeafTest>
+int BVH::closestHitTraversal (Ray & ray, float & t, LeafTest leafHit) const {
+  if (nodes.empty ())
+    return -1;
+  RayQuery query;
+  float o[3], inv[3];
+  setupRay (ray, o, inv);
+  unsigned int stack[MAX_DEPTH];
+  float stackT[MAX_DEPTH];
+  unsigned int stackSize = 0;
+  int best = -1;
+  float tBest = 1e30f;
+  unsigned int current = 0;
+  query.nodesVisited++;
+  if (hitBox (nodes[0], o, inv, tBest) < 0.0f) {
+    query.earlyOuts++;
+    return -1;
+  }
+  while (true) {
+    const BVHNode & node = nodes[current];
+    if (node.count > 0) {
+      query.triangleTests += node.count;
+      leafHit (node.offset, node.count, tBest, best);
+    } else {
+      // Visit the nearest child first, the other one is pushed on the stack
+      float tl = hitBox (nodes[current + 1], o, inv, tBest);
+      float tr = hitBox (nodes[node.offset], o, inv, tBest);
+      query.nodesVisited += 2;
+      query.earlyOuts += (tl < 0.0f) + (tr < 0.0f);
+      unsigned int l = current + 1, r = node.offset;
+      if (tl >= 0.0f && tr >= 0.0f) {
+        if (tr < tl) {
+          swap (l, r);
+          swap (tl, tr);
+        }
+        stack[stackSize] = r;
+        stackT[stackSize++] = tr;
+        current = l;
+        continue;
+      }
+      if (tl >= 0.0f) {
+        current = l;
+        continue;
+      }
+      if (tr >= 0.0f) {
+        current = r;
+        continue;
+      }
+    }
+    // Pop the next node still closer than the best hit
+    do {
+      if (stackSize == 0) {
+        t = tBest;
+        query.hit = best >= 0;
+        return best;
+      }
+      --stackSize;
+    } while (stackT[stackSize] > tBest);
+    current = stack[stackSize];
+  }
+}
+
+int BVH::closestHit (Ray & ray, const Mesh &, unsigned int source, float & t) const {
+  return closestHitTraversal (ray, t, [&] (unsigned int first, unsigned int count, float & tBest, int & best) {
+    for (unsigned int i = first; i < first + count; i += TriangleSoA::PACKET_SIZE) {
+      float tk[TriangleSoA::PACKET_SIZE];
+      unsigned int n = min (TriangleSoA::PACKET_SIZE, first + count - i);
+      unsigned int hits = intersectPacket (packets, i, n, ray, source, tk);
+      for (unsigned int j = 0; hits != 0; j++, hits >>= 1)
+        if ((hits & 1) && tk[j] < tBest) {
+          tBest = tk[j];
+          best = triangles[i + j];
+        }
+    }
+  });
+}
+
+int BVH::closestHit (Ray & ray, const CompactMesh & mesh, unsigned int source, float & t) const {
+  return closestHitTraversal (ray, t, [&] (unsigned int first, unsigned int count, float & tBest, int & best) {
+    for (unsigned int i = first; i < first + count; i++) {
+      unsigned int v[3];
+      mesh.triangle (triangles[i], v);
+      if (v[0] == source || v[1] == source || v[2] == source)
+        continue;
+      float tk;
+      if (ray.intersect (mesh.position (v[0]), mesh.position (v[1]), mesh.position (v[2]), tk) && tk < tBest) {
+        tBest = tk;
+        best = triangles[i];
+      }
+    }
+  });
+}
+
+size_t BVH::memoryBytes () const {
+  return nodes.capacity () * sizeof (BVHNode) + triangles.capacity () * sizeof (unsigned int) + packets.memoryBytes ();
+}
@@ -0,0 +1,88 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "Ray.h"
+#include "Aligned.h"
+#include "TriangleSoA.h"
+#include "CompactMesh.h"
+
+/// A node of the flattened BVH, two nodes per cache line.
+/// Nodes are stored depth-first: the left child of an internal node
+/// immediately follows it, 'offset' is the index of the right child.
+/// For leaves, 'offset' is the first entry in BVH::triangles and 'count' > 0.
+class BVHNode {
+ public:
+  float bmin[3];
+  unsigned int offset;
+  float bmax[3];
+  unsigned int count;
+};
+
+/// Bounding volume hierarchy over the triangles of a mesh, built with a binned
+/// surface area heuristic.
+class BVH {
+ public:
+  std::vector<BVHNode, AlignedAllocator<BVHNode> > nodes;
+  std::vector<unsigned int> triangles;
+  /// The triangles in the order of 'triangles', tested by packets in the leaves
+  TriangleSoA packets;
+
+  /// Builds the hierarchy over mesh.T (to be called after Mesh::loadOFF)
+  void build (const Mesh & mesh);
+
+  /// Builds the hierarchy over the triangles of a compact mesh, with boxes
+  /// bounding the quantized triangles and without the float packets: the
+  /// queries on the compact mesh decode the triangles of the leaves
+  void build (const CompactMesh & mesh);
+
+  /// Refreshes the leaf triangle data from the mesh (after loading 'nodes' and
+  /// 'triangles' from a cache, or after moving vertices within the boxes)
+  void updateTriangleData (const Mesh & mesh);
+
+  /// Checks that the hierarchy is well formed over numTriangles triangles (e.g.
+  /// when read from a cache): children stored after their parent, leaves and
+  /// triangle indices in range, depth below MAX_DEPTH
+  bool valid (unsigned int numTriangles) const;
+
+  /// Shadow query: returns 1 as soon as the ray hits a triangle closer than tMax.
+  /// The ray starts on the vertex 'source' (or NO_VERTEX), whose incident
+  /// triangles are not tested.
+  int anyHit (Ray & ray, const Mesh & mesh, unsigned int source, float tMax = 1e30f) const;
+
+  /// The same query on a compact mesh, with a hierarchy built by build (const CompactMesh &)
+  int anyHit (Ray & ray, const CompactMesh & mesh, unsigned int source, float tMax = 1e30f) const;
+
+  /// Returns the index of the closest triangle hit by the ray and its distance
+  /// in t, or -1 if there is none
+  int closestHit (Ray & ray, const Mesh & mesh, unsigned int source, float & t) const;
+  int closestHit (Ray & ray, const CompactMesh & mesh, unsigned int source, float & t) const;
+
+  /// Bytes of the nodes, the triangle list and the packets
+  size_t memoryBytes () const;
+
+ private:
+  static const unsigned int NUM_BINS = 16;
+  static const unsigned int MAX_LEAF_SIZE = 8;
+  static const unsigned int MAX_DEPTH = 64;
+
+  /// Shadow traversal, leafHit (first, count) tests the leaf entries [first, first + count)
+  template <class LeafTest>
+  int anyHitTraversal (Ray & ray, float tMax, LeafTest leafHit) const;
+
+  /// Nearest-first traversal, leafHit (first, count, tBest, best) lowers tBest
+  /// to the closest hit of the leaf entries and sets best to its triangle
+  template <class LeafTest>
+  int closestHitTraversal (Ray & ray, float & t, LeafTest leafHit) const;
+
+  /// Builds the nodes over the triangle boxes
+  void buildFromBoxes (const std::vector<Vec3<float> > & bmins, const std::vector<Vec3<float> > & bmaxs);
+
+  void buildNode (const std::vector<Vec3<float> > & bmins, const std::vector<Vec3<float> > & bmaxs,
+                  const std::vector<Vec3<float> > & centroids,
+                  unsigned int first, unsigned int count, unsigned int depth);
+};
+
+#endif
@@ -0,0 +1,483 @@
+// Benchmark of the rendering pipeline, without OpenGL: mesh loading, normal
+// computation, acceleration structure construction, shadow and ambient
+// occlusion rays, and BRDF shading. Progress goes to std::cerr, the results
+// to std::cout as JSON.
+//
+// Usage: ./benchmark [<file.off> ...] (models/*.off with "make bench")
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdio>
+#include <cmath>
+
+#include "Vec3.h"
+#include "Mesh.h"
+#include "HalfEdge.h"
+#include "MeshReorder.h"
+#include "Ray.h"
+#include "BSH.h"
+#include "BVH.h"
+#include "CompactMesh.h"
+#include "PagedMesh.h"
+#include "AmbientOcclusion.h"
+#include "Shading.h"
+#include "BRDFBatch.h"
+#include "BRDFTable.h"
+#include "Parallel.h"
+#include "RayStats.h"
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+using namespace std;
+
+static const Vec3<float> light_pos (0.0f, 1.0f, 0.0f);
+static const Vec3<float> camera_pos (0.0f, 0.0f, 3.0f);
+static const unsigned int MAX_BRUTE_FORCE_RAYS = 1000;
+static const float BATCH_MAX_ERROR = 1e-4f;   // as the viewer
+static const unsigned int L1_BYTES = 32 * 1024;
+static const unsigned int PAGED_TRIANGLES_PER_PAGE = 4096;
+static const size_t PAGED_SORT_BYTES = 4 << 20;
+static const unsigned int PAGED_BUDGET_PAGES = 4;   // cache size, in largest pages
+static const unsigned int PAGED_PER_RAY_RAYS = 1024;
+
+// Runs f until minSeconds have elapsed (at least once), returns the mean time of a run
+double measure (const function<void ()> & f, double minSeconds = 0.2) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now ();
+  unsigned int runs = 0;
+  double elapsed;
+  do {
+    f ();
+    runs++;
+    elapsed = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+  } while (elapsed < minSeconds);
+  return elapsed / runs;
+}
+
+// Shadow rays from every stride-th vertex toward the light, returns the rays per
+// second and the work of the queries in stats
+double shadowRaysPerSecond (const Mesh & mesh, unsigned int stride,
+                            const function<int (Ray &, unsigned int)> & query, RayStats & stats) {
+  unsigned int numRays = (mesh.V.size () + stride - 1) / stride;
+  RayStats::collect ();
+  double seconds = measure ([&] () {
+    parallelFor (numRays, 64, [&] (unsigned int begin, unsigned int end) {
+      for (unsigned int r = begin; r < end; r++) {
+        const Vertex & v = mesh.V[r * stride];
+        Ray ray (v.p[0], v.p[1], v.p[2], light_pos[0], light_pos[1], light_pos[2]);
+        query (ray, r * stride);
+      }
+    });
+  });
+  stats = RayStats::collect ();
+  return numRays / seconds;
+}
+
+// Per ray averages of the counters, as a JSON object
+void printRayStats (const char * name, const RayStats & s) {
+  double r = s.rays > 0 ? s.rays : 1;
+  printf ("\"%s\": {\"tests_per_ray\": %.2f, \"nodes_per_ray\": %.2f, \"early_outs_per_ray\": %.2f, \"hit_rate\": %.4f}",
+          name, s.triangleTests / r, s.nodesVisited / r, s.earlyOuts / r, s.hits / r);
+}
+
+// Locality of a layout of the mesh: simulated vertex cache and L1 misses, and
+// the times of the loops which gather vertices per triangle
+struct LayoutStats {
+  double reorderSeconds, acmr, fetchMisses, normalsSeconds, recordsSeconds, bvhRays, aoRays;
+};
+
+LayoutStats measureLayout (const string & filename, int order) {
+  Mesh mesh;
+  BVH bvh;
+  LayoutStats stats;
+  mesh.loadOFF (filename);
+  stats.reorderSeconds = 0.0;
+  if (order >= 0) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now ();
+    MeshReorder::reorder (mesh, MeshReorder::VertexOrder (order));
+    stats.reorderSeconds = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+  }
+  stats.acmr = MeshReorder::averageCacheMissRatio (mesh);
+  stats.fetchMisses = MeshReorder::vertexFetchMissRatio (mesh, L1_BYTES);
+  stats.normalsSeconds = measure ([&] () { mesh.recomputeNormals (); });
+  stats.recordsSeconds = measure ([&] () { mesh.updateTriangleRecords (); });
+  bvh.build (mesh);
+  RayStats rays;
+  stats.bvhRays = shadowRaysPerSecond (mesh, 1, [&] (Ray & ray, unsigned int i) {
+    return bvh.anyHit (ray, mesh, i);
+  }, rays);
+  AmbientOcclusion ao;
+  ao.numSamples = ao.samplesPerPass;
+  stats.aoRays = double (mesh.V.size ()) * ao.samplesPerPass / measure ([&] () {
+    ao.reset (mesh);
+    ao.refine (mesh, bvh);
+  });
+  return stats;
+}
+
+// Out-of-core mesh converted to a paged file next to the model, with a cache of
+// PAGED_BUDGET_PAGES pages: conversion, and shadow rays and shading page by
+// page, checked against the in-core mesh. The shadow rays go as a batch (each
+// page read once) and ray by ray (about PAGED_PER_RAY_RAYS rays in page order,
+// each walking its own pages through the cache).
+struct PagedRun {
+  double rays;
+  PagedMesh::Stats cache;   // counters of the run
+};
+
+struct PagedStats {
+  unsigned int pages, mismatches, perRayRays;
+  size_t fileBytes, largestPage, budget, peakResidentBytes;
+  double convertSeconds, shadingRate;
+  PagedRun batch, perRay;
+};
+
+// Runs the shadow queries f once, with the cache counters of the run
+PagedRun measurePagedRun (PagedMesh & paged, unsigned int numRays, const function<void ()> & f) {
+  PagedRun run;
+  PagedMesh::Stats before = paged.stats ();
+  run.rays = numRays / measure (f, 0.0);
+  run.cache = paged.stats ();
+  run.cache.requests -= before.requests;
+  run.cache.hits -= before.hits;
+  run.cache.loads -= before.loads;
+  run.cache.evictions -= before.evictions;
+  return run;
+}
+
+void printPagedRun (const char * name, const PagedRun & run) {
+  printf ("\"%s\": {\"shadow_rays_per_s\": %.0f, \"requests\": %llu, \"hits\": %llu, \"loads\": %llu, \"evictions\": %llu}",
+          name, run.rays, run.cache.requests, run.cache.hits, run.cache.loads, run.cache.evictions);
+}
+
+PagedStats measurePaged (const string & filename, const Mesh & mesh, const BVH & bvh) {
+  PagedStats stats = PagedStats ();
+  string pagedFilename = filename + ".pages";
+  chrono::steady_clock::time_point start = chrono::steady_clock::now ();
+  if (!PagedMesh::convert (filename, pagedFilename, PAGED_SORT_BYTES, PAGED_TRIANGLES_PER_PAGE))
+    return stats;
+  stats.convertSeconds = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+  FILE * file = fopen (pagedFilename.c_str (), "rb");
+  if (file != 0) {
+    fseek (file, 0, SEEK_END);
+    stats.fileBytes = ftell (file);
+    fclose (file);
+  }
+  // The page table gives the size of the largest page, to size the cache
+  PagedMesh paged;
+  if (paged.open (pagedFilename, (size_t) -1)) {
+    for (unsigned int p = 0; p < paged.numPages (); p++)
+      stats.largestPage = max (stats.largestPage, PagedMesh::pageBytes (paged.pageInfo (p)));
+    stats.budget = PAGED_BUDGET_PAGES * stats.largestPage;
+  }
+  if (stats.budget > 0 && paged.open (pagedFilename, stats.budget)) {
+    stats.pages = paged.numPages ();
+    // One shadow ray per vertex of each page
+    vector<Ray> rays;
+    vector<unsigned int> sources;
+    for (unsigned int p = 0; p < paged.numPages (); p++) {
+      shared_ptr<const PagedMesh::Page> page = paged.acquire (p);
+      const Mesh & m = page->mesh;
+      for (unsigned int i = 0; i < page->vertexIds.size (); i++) {
+        rays.push_back (Ray (m.positions[i][0], m.positions[i][1], m.positions[i][2], light_pos[0], light_pos[1], light_pos[2]));
+        sources.push_back (page->vertexIds[i]);
+      }
+    }
+    vector<int> hits;
+    stats.batch = measurePagedRun (paged, rays.size (), [&] () { paged.anyHit (rays, sources, 1e30f, hits); });
+    unsigned int stride = max ((size_t) 1, rays.size () / PAGED_PER_RAY_RAYS);
+    stats.perRayRays = (rays.size () + stride - 1) / stride;
+    stats.perRay = measurePagedRun (paged, stats.perRayRays, [&] () {
+      parallelFor (stats.perRayRays, 16, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int r = begin; r < end; r++) {
+          Ray ray = rays[r * stride];
+          paged.anyHit (ray, sources[r * stride]);
+        }
+      });
+    });
+    stats.shadingRate = rays.size () / measure ([&] () {
+      paged.shade (brdfKernel (BRDF_BLINN_PHONG), light_pos, camera_pos, [] (const PagedMesh::Page &, const float *) {});
+    });
+    for (unsigned int r = 0; r < rays.size (); r++) {
+      unsigned int v = sources[r];
+      Ray inCoreRay (mesh.positions[v][0], mesh.positions[v][1], mesh.positions[v][2],
+                     light_pos[0], light_pos[1], light_pos[2]);
+      stats.mismatches += hits[r] != bvh.anyHit (inCoreRay, mesh, v);
+    }
+    stats.peakResidentBytes = paged.stats ().peakResidentBytes;
+    paged.close ();
+  }
+  remove (pagedFilename.c_str ());
+  return stats;
+}
+
+void benchModel (const string & filename) {
+  Mesh mesh;
+  BVH bvh;
+  BSH bsh;
+  cerr << "--- " << filename << endl;
+  double loadSeconds = measure ([&] () { mesh.loadOFF (filename); }, 0.0);
+  if (mesh.V.empty ())
+    return;
+  double adjacencySeconds = measure ([&] () { mesh.updateVertexTriangles (); });
+  double normalsSeconds = measure ([&] () { mesh.recomputeNormals (); });
+  HalfEdges halfEdges;
+  double halfEdgesSeconds = measure ([&] () { halfEdges.build (mesh); });
+  unsigned int borderHalfEdges = count (halfEdges.opposite.begin (), halfEdges.opposite.end (), HalfEdges::NONE);
+  double areaNormalsSeconds = measure ([&] () { mesh.recomputeNormals (Mesh::AREA_WEIGHTS); });
+  double angleNormalsSeconds = measure ([&] () { mesh.recomputeNormals (Mesh::ANGLE_WEIGHTS); });
+  mesh.recomputeNormals ();
+  double bvhSeconds = measure ([&] () { bvh.build (mesh); });
+  double bshSeconds = measure ([&] () { bsh.build (mesh); });
+
+  RayStats bvhStats, bshStats, bruteStats, aoStats;
+  double bvhRays = shadowRaysPerSecond (mesh, 1, [&] (Ray & ray, unsigned int i) {
+    return bvh.anyHit (ray, mesh, i);
+  }, bvhStats);
+  double bshRays = shadowRaysPerSecond (mesh, 1, [&] (Ray & ray, unsigned int i) {
+    return bsh.intersect (ray, mesh, i);
+  }, bshStats);
+  unsigned int stride = max (1u, (unsigned int) mesh.V.size () / MAX_BRUTE_FORCE_RAYS);
+  double bruteRays = shadowRaysPerSecond (mesh, stride, [&] (Ray & ray, unsigned int i) {
+    RayQuery query;
+    for (unsigned int k = 0; k < mesh.records.size (); k++)
+      if (!mesh.records[k].contains (i)) {
+        query.triangleTests++;
+        if (ray.intersect (mesh.records[k])) {
+          query.hit = 1;
+          return 1;
+        }
+      }
+    return 0;
+  }, bruteStats);
+
+  AmbientOcclusion ao;
+  ao.numSamples = ao.samplesPerPass;
+  RayStats::collect ();
+  double aoSeconds = measure ([&] () {
+    ao.reset (mesh);
+    ao.refine (mesh, bvh);
+  });
+  double aoRays = double (mesh.V.size ()) * ao.samplesPerPass / aoSeconds;
+  aoStats = RayStats::collect ();
+
+  const char * brdfNames[3] = {"blinn_phong", "cook_torrance", "ggx"};
+  double shadingRate[3];
+  vector<float> colors (mesh.V.size ());
+  for (int brdf = 0; brdf < 3; brdf++) {
+    BRDFKernel kernel = brdfKernel (brdf);
+    double seconds = measure ([&] () {
+      parallelFor (mesh.V.size (), 256, [&] (unsigned int begin, unsigned int end) {
+        kernel (&mesh.positions[0], &mesh.normals[0], light_pos, camera_pos, begin, end, &colors[0]);
+      });
+    });
+    shadingRate[brdf] = mesh.V.size () / seconds;
+  }
+
+  // Batch kernels on one core, from precomputed directions, exact and with the
+  // fast exponentials; the error is relative to evaluateBRDF at the lit vertices
+  ShadingBatch batch;
+  batch.build (&mesh.positions[0], &mesh.normals[0], mesh.V.size (), light_pos, camera_pos);
+  BRDFInputs inputs = batch.inputs ();
+  double batchExactRate[3], batchFastRate[3], batchShadingRate[3], batchError[3];
+  vector<float> reference (mesh.V.size ());
+  for (int brdf = 0; brdf < 3; brdf++) {
+    BRDFBatchFunction exact = brdfBatchFunction (brdf, 0.0f);
+    BRDFBatchFunction fast = brdfBatchFunction (brdf, BATCH_MAX_ERROR);
+    batchExactRate[brdf] = batch.size () / measure ([&] () { exact (inputs, batch.size (), &colors[0]); });
+    batchFastRate[brdf] = batch.size () / measure ([&] () { fast (inputs, batch.size (), &colors[0]); });
+    BRDFFunction f = brdfFunction (brdf);
+    batchError[brdf] = 0.0;
+    for (unsigned int i = 0; i < mesh.V.size (); i++) {
+      reference[i] = f (mesh.positions[i], mesh.normals[i], light_pos, camera_pos);
+      float nl = inputs.n[0][i] * inputs.l[0][i] + inputs.n[1][i] * inputs.l[1][i] + inputs.n[2][i] * inputs.l[2][i];
+      if (nl > 0.0f && reference[i] != 0.0f && isfinite (reference[i]))
+        batchError[brdf] = max (batchError[brdf], fabs (double (colors[i]) - reference[i]) / fabs (reference[i]));
+    }
+
+    BRDFKernel kernel = brdfBatchKernel (brdf, BATCH_MAX_ERROR);
+    double seconds = measure ([&] () {
+      parallelFor (mesh.V.size (), 256, [&] (unsigned int begin, unsigned int end) {
+        kernel (&mesh.positions[0], &mesh.normals[0], light_pos, camera_pos, begin, end, &colors[0]);
+      });
+    });
+    batchShadingRate[brdf] = mesh.V.size () / seconds;
+  }
+
+  // Lookup tables of the microfacet BRDFs against the analytic kernels, on one core
+  const int tableBRDFs[2] = {BRDF_COOK_TORRANCE, BRDF_GGX};
+  double tableBuildSeconds[2], tableAnalyticRate[2], tableRate[2], tableError[2];
+  for (int k = 0; k < 2; k++) {
+    BRDFTable table;
+    tableBuildSeconds[k] = measure ([&] () { table.build (tableBRDFs[k]); });
+    BRDFKernel analytic = brdfKernel (tableBRDFs[k]);
+    tableAnalyticRate[k] = mesh.V.size () / measure ([&] () {
+      analytic (&mesh.positions[0], &mesh.normals[0], light_pos, camera_pos, 0, mesh.V.size (), &reference[0]);
+    });
+    tableRate[k] = mesh.V.size () / measure ([&] () {
+      table.evaluateRange (&mesh.positions[0], &mesh.normals[0], light_pos, camera_pos, 0, mesh.V.size (), &colors[0]);
+    });
+    // The tables clamp the cosines: the error is measured at the lit vertices facing the camera
+    tableError[k] = 0.0;
+    for (unsigned int i = 0; i < mesh.V.size (); i++) {
+      float nl = inputs.n[0][i] * inputs.l[0][i] + inputs.n[1][i] * inputs.l[1][i] + inputs.n[2][i] * inputs.l[2][i];
+      float nv = inputs.n[0][i] * inputs.v[0][i] + inputs.n[1][i] * inputs.v[1][i] + inputs.n[2][i] * inputs.v[2][i];
+      if (nl > 0.0f && nv > 0.0f && reference[i] != 0.0f && isfinite (reference[i]))
+        tableError[k] = max (tableError[k], fabs (double (colors[i]) - reference[i]) / fabs (reference[i]));
+    }
+  }
+
+  // Compact vertices: memory, decoding error, shading and shadow rays decoded on
+  // the fly (through a BVH of the compact mesh, without packets), against the
+  // float arrays
+  CompactMesh compact;
+  double compactBuildSeconds = measure ([&] () { compact.build (mesh); });
+  size_t floatBytes = 2 * sizeof (Vec3f) * mesh.V.size () + sizeof (Triangle) * mesh.T.size ();
+  double positionError = 0.0, normalError = 0.0;
+  for (unsigned int i = 0; i < mesh.V.size (); i++) {
+    positionError = max (positionError, (double) dist (compact.position (i), mesh.positions[i]));
+    if (mesh.normals[i].squaredLength () == 0.0f)
+      continue;
+    float c = dot (compact.normal (i), normalize (mesh.normals[i]));
+    normalError = max (normalError, acos (min (1.0, (double) c)) * 180.0 / M_PI);
+  }
+  double compactShadingRate[3], compactShadingError[3];
+  for (int brdf = 0; brdf < 3; brdf++) {
+    CompactBRDFKernel kernel = compactBRDFKernel (brdf);
+    double seconds = measure ([&] () {
+      parallelFor (mesh.V.size (), 256, [&] (unsigned int begin, unsigned int end) {
+        kernel (compact, light_pos, camera_pos, begin, end, &colors[0]);
+      });
+    });
+    compactShadingRate[brdf] = mesh.V.size () / seconds;
+    BRDFFunction f = brdfFunction (brdf);
+    compactShadingError[brdf] = 0.0;
+    for (unsigned int i = 0; i < mesh.V.size (); i++) {
+      float r = f (mesh.positions[i], mesh.normals[i], light_pos, camera_pos);
+      if (r > 1e-3f && isfinite (r))
+        compactShadingError[brdf] = max (compactShadingError[brdf], fabs (double (colors[i]) - r) / r);
+    }
+  }
+  BVH compactBVH;
+  double compactBVHSeconds = measure ([&] () { compactBVH.build (compact); });
+  double compactBVHRays;
+  {
+    RayStats stats;
+    compactBVHRays = shadowRaysPerSecond (mesh, 1, [&] (Ray & ray, unsigned int i) {
+      return compactBVH.anyHit (ray, compact, i);
+    }, stats);
+  }
+  unsigned int shadowMismatches = 0;
+  for (unsigned int i = 0; i < mesh.V.size (); i++) {
+    Ray ray (mesh.positions[i][0], mesh.positions[i][1], mesh.positions[i][2], light_pos[0], light_pos[1], light_pos[2]);
+    Vec3f p = compact.position (i);
+    Ray compactRay (p[0], p[1], p[2], light_pos[0], light_pos[1], light_pos[2]);
+    shadowMismatches += bvh.anyHit (ray, mesh, i) != compactBVH.anyHit (compactRay, compact, i);
+  }
+
+  // Original order of the file, then Tipsify with first use and Morton vertex orders
+  const char * layoutNames[3] = {"original", "first_use", "morton"};
+  LayoutStats layouts[3];
+  for (int k = 0; k < 3; k++)
+    layouts[k] = measureLayout (filename, k - 1);
+  PagedStats paged = measurePaged (filename, mesh, bvh);
+
+  cerr << "load " << loadSeconds * 1e3 << " ms, normals " << normalsSeconds * 1e3
+       << " ms, BVH " << bvhSeconds * 1e3 << " ms, BSH " << bshSeconds * 1e3 << " ms" << endl
+       << "shadow rays/s: BVH " << bvhRays << ", BSH " << bshRays << ", brute force " << bruteRays
+       << ", AO rays/s " << aoRays << endl;
+
+  // Separator from the previous model printed: the models which fail to load are skipped
+  static bool first = true;
+  printf ("%s    {\n", first ? "" : ",\n");
+  first = false;
+  printf ("      \"model\": \"%s\",\n", filename.c_str ());
+  printf ("      \"vertices\": %u,\n      \"triangles\": %u,\n", (unsigned int) mesh.V.size (), (unsigned int) mesh.T.size ());
+  printf ("      \"load_ms\": %.3f,\n", loadSeconds * 1e3);
+  printf ("      \"vertex_triangles_ms\": %.3f,\n", adjacencySeconds * 1e3);
+  printf ("      \"half_edges_ms\": %.3f,\n", halfEdgesSeconds * 1e3);
+  printf ("      \"unpaired_half_edges\": %u,\n", borderHalfEdges);
+  printf ("      \"normals_ms\": %.3f,\n", normalsSeconds * 1e3);
+  printf ("      \"normals_area_ms\": %.3f,\n", areaNormalsSeconds * 1e3);
+  printf ("      \"normals_angle_ms\": %.3f,\n", angleNormalsSeconds * 1e3);
+  printf ("      \"bvh_build_ms\": %.3f,\n", bvhSeconds * 1e3);
+  printf ("      \"bsh_build_ms\": %.3f,\n", bshSeconds * 1e3);
+  printf ("      \"shadow_rays_per_s\": {\"bvh\": %.0f, \"bsh\": %.0f, \"brute_force\": %.0f},\n",
+          bvhRays, bshRays, bruteRays);
+  printf ("      \"shadow_ray_stats\": {");
+  printRayStats ("bvh", bvhStats);
+  printf (", ");
+  printRayStats ("bsh", bshStats);
+  printf (", ");
+  printRayStats ("brute_force", bruteStats);
+  printf ("},\n");
+  printf ("      \"ao_rays_per_s\": %.0f,\n", aoRays);
+  printf ("      \"ao_ray_stats\": {");
+  printRayStats ("bvh", aoStats);
+  printf ("},\n");
+  printf ("      \"shaded_vertices_per_s\": {");
+  for (int brdf = 0; brdf < 3; brdf++)
+    printf ("%s\"%s\": %.0f", brdf ? ", " : "", brdfNames[brdf], shadingRate[brdf]);
+  printf ("},\n");
+  printf ("      \"batch_shaded_vertices_per_s\": {");
+  for (int brdf = 0; brdf < 3; brdf++)
+    printf ("%s\"%s\": %.0f", brdf ? ", " : "", brdfNames[brdf], batchShadingRate[brdf]);
+  printf ("},\n");
+  printf ("      \"batch_brdf\": {\"max_error\": %g", BATCH_MAX_ERROR);
+  for (int brdf = 0; brdf < 3; brdf++)
+    printf (", \"%s\": {\"exact_evals_per_s\": %.0f, \"fast_evals_per_s\": %.0f, \"max_rel_error\": %.3g}",
+            brdfNames[brdf], batchExactRate[brdf], batchFastRate[brdf], batchError[brdf]);
+  printf ("},\n");
+  printf ("      \"brdf_tables\": {\"size\": %u", BRDFTable::SIZE);
+  for (int k = 0; k < 2; k++)
+    printf (", \"%s\": {\"build_ms\": %.3f, \"analytic_evals_per_s\": %.0f, \"table_evals_per_s\": %.0f, \"max_rel_error\": %.3g}",
+            brdfNames[tableBRDFs[k]], tableBuildSeconds[k] * 1e3, tableAnalyticRate[k], tableRate[k], tableError[k]);
+  printf ("},\n");
+  printf ("      \"compact\": {\"build_ms\": %.3f, \"float_bytes\": %zu, \"compact_bytes\": %zu, "
+          "\"max_position_error\": %.3g, \"max_normal_error_deg\": %.3g, \"shaded_vertices_per_s\": {",
+          compactBuildSeconds * 1e3, floatBytes, compact.memoryBytes (), positionError, normalError);
+  for (int brdf = 0; brdf < 3; brdf++)
+    printf ("%s\"%s\": %.0f", brdf ? ", " : "", brdfNames[brdf], compactShadingRate[brdf]);
+  printf ("}, \"shading_max_rel_error\": {");
+  for (int brdf = 0; brdf < 3; brdf++)
+    printf ("%s\"%s\": %.3g", brdf ? ", " : "", brdfNames[brdf], compactShadingError[brdf]);
+  printf ("}, \"bvh_build_ms\": %.3f, \"bvh_bytes\": {\"packets\": %zu, \"compact\": %zu}, "
+          "\"bvh_shadow_rays_per_s\": {\"packets\": %.0f, \"compact\": %.0f}, \"shadow_mismatches\": %u},\n",
+          compactBVHSeconds * 1e3, bvh.memoryBytes (), compactBVH.memoryBytes (), bvhRays, compactBVHRays, shadowMismatches);
+  printf ("      \"layouts\": {\"cache_size\": %u, \"l1_bytes\": %u", MeshReorder::CACHE_SIZE, L1_BYTES);
+  for (int k = 0; k < 3; k++)
+    printf (", \"%s\": {\"reorder_ms\": %.3f, \"acmr\": %.3f, \"l1_misses_per_triangle\": %.3f, \"normals_ms\": %.3f, "
+            "\"triangle_records_ms\": %.3f, \"bvh_shadow_rays_per_s\": %.0f, \"ao_rays_per_s\": %.0f}",
+            layoutNames[k], layouts[k].reorderSeconds * 1e3, layouts[k].acmr, layouts[k].fetchMisses,
+            layouts[k].normalsSeconds * 1e3, layouts[k].recordsSeconds * 1e3, layouts[k].bvhRays, layouts[k].aoRays);
+  printf ("},\n");
+  printf ("      \"paged\": {\"triangles_per_page\": %u, \"pages\": %u, \"file_bytes\": %zu, \"convert_ms\": %.3f, "
+          "\"largest_page_bytes\": %zu, \"budget_bytes\": %zu, \"peak_resident_bytes\": %zu, ",
+          PAGED_TRIANGLES_PER_PAGE, paged.pages, paged.fileBytes, paged.convertSeconds * 1e3,
+          paged.largestPage, paged.budget, paged.peakResidentBytes);
+  printPagedRun ("batch", paged.batch);
+  printf (", \"per_ray_rays\": %u, ", paged.perRayRays);
+  printPagedRun ("per_ray", paged.perRay);
+  printf (", \"shaded_vertices_per_s\": %.0f, \"shadow_mismatches\": %u}\n    }",
+          paged.shadingRate, paged.mismatches);
+  fflush (stdout);
+}
+
+int main (int argc, char ** argv) {
+#if defined(VEC3_SIMD) && defined(__SSE2__)
+  const char * vec3 = "sse";
+#else
+  const char * vec3 = "scalar";
+#endif
+  printf ("{\n  \"version\": \"%s\",\n  \"threads\": %u,\n  \"packet_kernel\": \"%s\",\n  \"vec3\": \"%s\",\n  \"brdf_kernel\": \"%s\",\n  \"models\": [\n",
+          BENCH_VERSION, ThreadPool::instance ().size (), packetKernelName (), vec3, brdfBatchKernelName ());
+  for (int i = 1; i < argc; i++)
+    benchModel (argv[i]);
+  printf ("\n  ]\n}\n");
+  return 0;
+}
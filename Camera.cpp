@@ -96,6 +96,7 @@ Camera::Camera () {
   trackball (curquat, 0.0, 0.0, 0.0, 0.0);
   x = y = z = 0.0;
   _zoom = 3.0;
+  moves = 0;
   
   mouseRotatePressed = false;
   mouseMovePressed = false;
@@ -146,6 +147,7 @@ void Camera::initPos () {
     y = _y;
     z = _z;;
     _zoom = __zoom;
+    moves++;
   } 
 }
 
@@ -154,6 +156,7 @@ void Camera::move (float dx, float dy, float dz) {
   x += dx;
   y += dy;
   z += dz;
+  moves++;
 }
 
 
@@ -176,6 +179,7 @@ void Camera::rotate (int u, int v) {
     beginv = v;
     spinning = 1;
     add_quats (lastquat, curquat, curquat);
+    moves++;
   }
 }
 
@@ -187,6 +191,7 @@ void Camera::endRotate () {
 
 void Camera::zoom (float z) {
   _zoom += z;
+  moves++;
 }
 
 
@@ -211,6 +216,38 @@ void Camera::getPos (float & X, float & Y, float & Z) {
   Z = m[2][0] * _x +  m[2][1] * _y +  m[2][2] * _z;
 }
 
+void Camera::getFrame (Vec3f & pos, Vec3f & right, Vec3f & up, Vec3f & back) {
+  getPos (pos);
+  GLfloat m[4][4]; 
+  build_rotmatrix(m, curquat);
+  right = Vec3f (m[0][0], m[1][0], m[2][0]);
+  up = Vec3f (m[0][1], m[1][1], m[2][1]);
+  back = Vec3f (m[0][2], m[1][2], m[2][2]);
+}
+
+void Camera::write (std::ostream & out) const {
+  out << fovAngle << " " << aspectRatio << " "
+      << curquat[0] << " " << curquat[1] << " " << curquat[2] << " " << curquat[3] << " "
+      << x << " " << y << " " << z << " " << _zoom << std::endl;
+}
+
+bool Camera::read (std::istream & in) {
+  float v[10];
+  for (unsigned int i = 0; i < 10; i++)
+    if (!(in >> v[i]))
+      return false;
+  fovAngle = v[0];
+  aspectRatio = v[1];
+  for (unsigned int i = 0; i < 4; i++)
+    curquat[i] = v[2 + i];
+  x = v[6];
+  y = v[7];
+  z = v[8];
+  _zoom = v[9];
+  moves++;
+  return true;
+}
+
 void Camera::handleMouseClickEvent (int button, int state, int x, int y) {
 	if (state == GLUT_UP) {
         mouseMovePressed = false;
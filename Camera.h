@@ -19,6 +19,7 @@
 
 #pragma once
 
+#include <iostream>
 #include "Vec3.h"
 
 class Camera {
@@ -29,6 +30,7 @@ public:
   inline float getFovAngle () const { return fovAngle; }
   inline void setFovAngle (float newFovAngle) { fovAngle = newFovAngle; }
   inline float getAspectRatio () const { return aspectRatio; }
+  inline void setAspectRatio (float newAspectRatio) { aspectRatio = newAspectRatio; }
   inline float getNearPlane () const { return nearPlane; }
   inline void setNearPlane (float newNearPlane) { nearPlane = newNearPlane; }
   inline float getFarPlane () const { return farPlane; }
@@ -49,6 +51,16 @@ public:
   
   void getPos (float & x, float & y, float & z);
   inline void getPos (Vec3f & p) { getPos (p[0], p[1], p[2]); }
+
+  /// World space position and axes of the camera (it looks along -back), without OpenGL
+  void getFrame (Vec3f & pos, Vec3f & right, Vec3f & up, Vec3f & back);
+
+  /// Saves/restores the pose and the projection (one line of text)
+  void write (std::ostream & out) const;
+  bool read (std::istream & in);
+
+  /// Incremented each time the camera moves, rotates or zooms
+  inline unsigned int getMoveCount () const { return moves; }
     
   // Connecting typical GLUT events
   void handleMouseClickEvent (int button, int state, int x, int y);
@@ -67,6 +79,7 @@ private:
   float lastquat[4];
   float x, y, z;
   float _zoom;
+  unsigned int moves;
   
   bool mouseRotatePressed;
   bool mouseMovePressed;
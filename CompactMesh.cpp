@@ -0,0 +1,220 @@
+#include "CompactMesh.h"
+#include "Shading.h"
+#include "Parallel.h"
+#include "Profiler.h"
+#include "OFFFile.h"
+#include <iostream>
+#include <chrono>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  inline unsigned short quantize (float x) {
+    float u = (max (-1.0f, min (1.0f, x)) + 1.0f) * 0.5f * 65535.0f;
+    return (unsigned short) (u + 0.5f);
+  }
+
+  inline unsigned int snorm16 (float x) {
+    return (unsigned short) short (lrintf (max (-1.0f, min (1.0f, x)) * 32767.0f));
+  }
+
+  template <class BRDF>
+  void evaluateCompactRange (const CompactMesh & mesh, const Vec3<float> & light, const Vec3<float> & camera,
+                             unsigned int begin, unsigned int end, float * out) {
+    for (unsigned int i = begin; i < end; i++)
+      out[i] = evaluateBRDF<BRDF> (mesh.position (i), mesh.normal (i), light, camera);
+  }
+}
+
+unsigned int CompactMesh::encodeNormal (const Vec3f & n) {
+  float l1 = fabs (n[0]) + fabs (n[1]) + fabs (n[2]);
+  if (!(l1 > 0.0f))
+    return 0;
+  // Projection on the octahedron, whose lower half is folded over the upper one
+  float x = n[0] / l1, y = n[1] / l1;
+  if (n[2] < 0.0f) {
+    float t = x;
+    x = copysign (1.0f - fabs (y), t);
+    y = copysign (1.0f - fabs (t), y);
+  }
+  return snorm16 (x) | snorm16 (y) << 16;
+}
+
+void CompactMesh::build (const Mesh & mesh) {
+  build (mesh.positions.data (), mesh.normals.size () == mesh.positions.size () ? mesh.normals.data () : 0,
+         mesh.positions.size (), mesh.indices (), mesh.T.size ());
+}
+
+void CompactMesh::build (const Vec3f * vertexPositions, const Vec3f * vertexNormals, unsigned int numVertices,
+                         const unsigned int * indices, unsigned int numTriangles) {
+  PROFILE_ZONE ("CompactMesh::build");
+  encodeVertices (vertexPositions, vertexNormals, numVertices);
+  blockBase.clear ();
+  blockStart.clear ();
+  shortIndices.clear ();
+  wideIndices.clear ();
+  numTriangleIndices = 0;
+  blockBase.reserve ((numTriangles + BLOCK_SIZE - 1) / BLOCK_SIZE);
+  blockStart.reserve (blockBase.capacity ());
+  for (unsigned int first = 0; first < 3 * numTriangles; first += 3 * BLOCK_SIZE)
+    appendBlock (indices + first, min (3 * BLOCK_SIZE, 3 * numTriangles - first));
+  shortIndices.shrink_to_fit ();
+  wideIndices.shrink_to_fit ();
+}
+
+void CompactMesh::encodeVertices (const Vec3f * vertexPositions, const Vec3f * vertexNormals, unsigned int numVertices) {
+  positions.resize (numVertices);
+  normals.resize (numVertices);
+  parallelFor (numVertices, 4096, [&] (unsigned int begin, unsigned int end) {
+    for (unsigned int i = begin; i < end; i++) {
+      for (unsigned int c = 0; c < 3; c++)
+        positions[i].x[c] = quantize (vertexPositions[i][c]);
+      normals[i] = vertexNormals != 0 ? encodeNormal (vertexNormals[i]) : 0;
+    }
+  });
+}
+
+void CompactMesh::appendBlock (const unsigned int * indices, unsigned int count) {
+  unsigned int low = *min_element (indices, indices + count);
+  unsigned int high = *max_element (indices, indices + count);
+  blockBase.push_back (low);
+  if (high - low <= 0xffff) {
+    blockStart.push_back (shortIndices.size ());
+    for (unsigned int i = 0; i < count; i++)
+      shortIndices.push_back (indices[i] - low);
+  } else {
+    blockStart.push_back (WIDE | wideIndices.size ());
+    wideIndices.insert (wideIndices.end (), indices, indices + count);
+  }
+  numTriangleIndices += count;
+}
+
+bool CompactMesh::loadOFF (const string & filename) {
+  PROFILE_ZONE ("CompactMesh::loadOFF");
+  chrono::steady_clock::time_point start = chrono::steady_clock::now ();
+  MappedFile file (filename);
+  if (file.data == 0) {
+    cerr << filename << ": cannot read the file" << endl;
+    return false;
+  }
+  OFFParser parser (file.data, file.data + file.size);
+  string offString;
+  unsigned int sizeV, sizeT, sizeE;
+  if (!parser.readWord (offString) || offString != "OFF"
+      || !parser.readUInt (sizeV) || !parser.readUInt (sizeT) || !parser.readUInt (sizeE)) {
+    cerr << filename << ": not an OFF file (bad header)" << endl;
+    return false;
+  }
+  if (sizeV == 0) {
+    cerr << filename << ": the mesh has no vertex" << endl;
+    return false;
+  }
+  parser.skipLine ();
+
+  // Vertices, centered and scaled to the unit sphere with the operations of
+  // Mesh::centerAndScaleToUnit, so that both give the same positions
+  Vec3fArray floatPositions (sizeV), normalSums (sizeV);
+  Vec3f c;
+  const char * released = file.data;
+  for (unsigned int i = 0; i < sizeV; i++) {
+    Vec3f & p = floatPositions[i];
+    if (!parser.readFloat (p[0]) || !parser.readFloat (p[1]) || !parser.readFloat (p[2])) {
+      cerr << filename << ":" << parser.line (file.data) << ": bad vertex " << i << endl;
+      return false;
+    }
+    c += p;
+    if (parser.p - released > (ptrdiff_t) MappedFile::RELEASE_BYTES)
+      file.release (released = parser.p);
+  }
+  c /= sizeV;
+  float maxD = dist (floatPositions[0], c);
+  for (unsigned int i = 0; i < sizeV; i++)
+    maxD = max (maxD, dist (floatPositions[i], c));
+  for (unsigned int i = 0; i < sizeV; i++)
+    floatPositions[i] = (floatPositions[i] - c) / maxD;
+
+  // Faces, split in fans as Mesh::loadOFF does and encoded a block at a time.
+  // The unit triangle normals are summed per vertex in the order of the
+  // triangles, as Mesh::recomputeNormals.
+  CompactMesh loaded;
+  vector<unsigned int> block;
+  block.reserve (3 * BLOCK_SIZE);
+  for (unsigned int i = 0; i < sizeT; i++) {
+    unsigned int n, v0, v1, v2;
+    if (!parser.readUInt (n) || n < 3 || !parser.readUInt (v0) || !parser.readUInt (v2)) {
+      cerr << filename << ":" << parser.line (file.data) << ": bad face " << i << endl;
+      return false;
+    }
+    for (unsigned int j = 2; j < n; j++) {
+      v1 = v2;
+      if (!parser.readUInt (v2)) {
+        cerr << filename << ":" << parser.line (file.data) << ": bad face " << i << endl;
+        return false;
+      }
+      if (v0 >= sizeV || v1 >= sizeV || v2 >= sizeV) {
+        cerr << filename << ":" << parser.line (file.data) << ": face " << i
+             << " has a vertex index out of range" << endl;
+        return false;
+      }
+      const Vec3f & p0 = floatPositions[v0], & p1 = floatPositions[v1], & p2 = floatPositions[v2];
+      Vec3f normal = cross (p1 - p0, p2 - p0);
+      normal.normalize ();
+      normalSums[v0] += normal;
+      normalSums[v1] += normal;
+      normalSums[v2] += normal;
+      block.push_back (v0);
+      block.push_back (v1);
+      block.push_back (v2);
+      if (block.size () == 3 * BLOCK_SIZE) {
+        loaded.appendBlock (&block[0], block.size ());
+        block.clear ();
+      }
+    }
+    if (parser.p - released > (ptrdiff_t) MappedFile::RELEASE_BYTES)
+      file.release (released = parser.p);
+  }
+  if (!block.empty ())
+    loaded.appendBlock (&block[0], block.size ());
+  loaded.shortIndices.shrink_to_fit ();
+  loaded.wideIndices.shrink_to_fit ();
+  for (unsigned int i = 0; i < sizeV; i++)
+    normalSums[i].normalize ();
+  loaded.encodeVertices (&floatPositions[0], &normalSums[0], sizeV);
+  *this = std::move (loaded);
+  double seconds = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+  cerr << filename << ": " << sizeV << " vertices, " << numTriangles () << " triangles, "
+       << file.size / 1e6 << " MB streamed in " << seconds * 1e3 << " ms" << endl;
+  return true;
+}
+
+void CompactMesh::decode (Mesh & mesh) const {
+  mesh.positions.resize (numVertices ());
+  mesh.normals.resize (numVertices ());
+  for (unsigned int i = 0; i < numVertices (); i++) {
+    mesh.positions[i] = position (i);
+    mesh.normals[i] = normal (i);
+  }
+  mesh.T.resize (numTriangles ());
+  for (unsigned int t = 0; t < numTriangles (); t++)
+    triangle (t, mesh.T[t].v);
+  mesh.updateVertexTriangles ();
+  mesh.updateTriangleRecords ();
+}
+
+size_t CompactMesh::memoryBytes () const {
+  return positions.size () * sizeof (Position) + normals.size () * sizeof (unsigned int)
+    + (blockBase.size () + blockStart.size () + wideIndices.size ()) * sizeof (unsigned int)
+    + shortIndices.size () * sizeof (unsigned short);
+}
+
+CompactBRDFKernel compactBRDFKernel (int brdf) {
+  switch (brdf) {
+  case BRDF_COOK_TORRANCE:
+    return evaluateCompactRange<CookTorrance>;
+  case BRDF_GGX:
+    return evaluateCompactRange<GGX>;
+  default:
+    return evaluateCompactRange<BlinnPhong>;
+  }
+}
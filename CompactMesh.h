@@ -0,0 +1,112 @@
+#ifndef COMPACT_MESH_H
+#define COMPACT_MESH_H
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include "Vec3.h"
+#include "Mesh.h"
+
+/// Compact copy of the vertices and triangles of a mesh scaled to the unit
+/// sphere (Mesh::centerAndScaleToUnit), decoded on the fly by its kernels:
+/// positions quantized to 16 bits per axis over [-1, 1] (error at most 1.53e-5
+/// per axis), unit normals octahedron-encoded in 2 x 16 bits (null normals
+/// decode to +z), and the vertex indices of
+/// each block of BLOCK_SIZE triangles stored as 16-bit offsets from the first
+/// vertex of the block when the block spans fewer than 65536 vertices (as
+/// 32-bit indices otherwise). That is 10 bytes per vertex instead of 24 (32
+/// with VEC3_SIMD), and about 6 bytes per triangle instead of 12 on a mesh
+/// reordered for locality (MeshReorder). BVH::build (const CompactMesh &) and
+/// the queries, AmbientOcclusion and Renderer take it in place of a Mesh
+/// (main --render --compact).
+class CompactMesh {
+ public:
+  static const unsigned int BLOCK_SIZE = 256;
+
+  struct Position {
+    unsigned short x[3];
+  };
+
+  std::vector<Position> positions;
+  std::vector<unsigned int> normals;        // two 16-bit signed coordinates on the octahedron
+  std::vector<unsigned int> blockBase;      // smallest vertex index of each block
+  std::vector<unsigned int> blockStart;     // first index of each block, in wideIndices if WIDE is set
+  std::vector<unsigned short> shortIndices;
+  std::vector<unsigned int> wideIndices;
+
+  CompactMesh () : numTriangleIndices (0) {}
+
+  /// Encodes the vertices and triangles of mesh
+  void build (const Mesh & mesh);
+
+  /// Encodes numVertices positions and normals (null normals: +z) and the 3
+  /// indices of numTriangles triangles, e.g. read from the sections of a cache
+  void build (const Vec3f * vertexPositions, const Vec3f * vertexNormals, unsigned int numVertices,
+              const unsigned int * indices, unsigned int numTriangles);
+
+  /// Loads an OFF file as Mesh::loadOFF followed by build would, streaming the
+  /// faces into the index blocks: only the float positions and the normal sums
+  /// are held aside, no float triangles, records nor vertex to triangle lists.
+  /// Reports the errors on cerr and leaves the mesh unchanged on failure.
+  bool loadOFF (const std::string & filename);
+
+  /// Replaces the vertices and triangles of mesh by the decoded ones (e.g. to
+  /// compare the float code paths on the quantized data)
+  void decode (Mesh & mesh) const;
+
+  inline unsigned int numVertices () const { return positions.size (); }
+  inline unsigned int numTriangles () const { return numTriangleIndices / 3; }
+
+  /// Bytes of the arrays
+  size_t memoryBytes () const;
+
+  inline Vec3f position (unsigned int i) const {
+    const float scale = 2.0f / 65535.0f;
+    return Vec3f (positions[i].x[0] * scale - 1.0f, positions[i].x[1] * scale - 1.0f, positions[i].x[2] * scale - 1.0f);
+  }
+
+  inline Vec3f normal (unsigned int i) const { return decodeNormal (normals[i]); }
+
+  /// Vertex indices of the triangle t
+  inline void triangle (unsigned int t, unsigned int v[3]) const {
+    unsigned int b = t / BLOCK_SIZE, k = 3 * (t % BLOCK_SIZE);
+    unsigned int start = blockStart[b];
+    if (start & WIDE)
+      for (unsigned int j = 0; j < 3; j++)
+        v[j] = wideIndices[(start & ~WIDE) + k + j];
+    else
+      for (unsigned int j = 0; j < 3; j++)
+        v[j] = blockBase[b] + shortIndices[start + k + j];
+  }
+
+  static unsigned int encodeNormal (const Vec3f & n);
+
+  static inline Vec3f decodeNormal (unsigned int e) {
+    float x = short (e & 0xffff) / 32767.0f, y = short (e >> 16) / 32767.0f;
+    float z = 1.0f - std::fabs (x) - std::fabs (y);
+    if (z < 0.0f) {
+      float t = x;
+      x = std::copysign (1.0f - std::fabs (y), t);
+      y = std::copysign (1.0f - std::fabs (t), y);
+    }
+    return normalize (Vec3f (x, y, z));
+  }
+
+ private:
+  static const unsigned int WIDE = 1u << 31;
+  unsigned int numTriangleIndices;
+
+  void encodeVertices (const Vec3f * vertexPositions, const Vec3f * vertexNormals, unsigned int numVertices);
+
+  /// Appends the block of the count (at most 3 BLOCK_SIZE) next triangle indices
+  void appendBlock (const unsigned int * indices, unsigned int count);
+};
+
+/// evaluateBRDF of one of the BRDF_* for the vertices [begin, end) of a compact
+/// mesh, into out[begin, end)
+typedef void (*CompactBRDFKernel) (const CompactMesh & mesh, const Vec3<float> & light, const Vec3<float> & camera,
+                                   unsigned int begin, unsigned int end, float * out);
+
+CompactBRDFKernel compactBRDFKernel (int brdf);
+
+#endif
@@ -0,0 +1,130 @@
+#include "HalfEdge.h"
+#include "Parallel.h"
+#include "Profiler.h"
+#include <algorithm>
+
+using namespace std;
+
+const unsigned int HalfEdges::NONE;
+
+namespace {
+  const unsigned int RADIX_BITS = 11;
+  const unsigned int RADIX = 1 << RADIX_BITS;
+
+  /// Number of bits of the values [0, n), 0 for an empty range
+  unsigned int bitsOf (unsigned long long n) {
+    unsigned int bits = 0;
+    while (n > 0 && bits < 64 && (n - 1) >> bits)
+      bits++;
+    return bits;
+  }
+
+  /// Stable least significant digit radix sort of the keys on their bits [firstBit, lastBit).
+  /// The array is cut in blocks: their digit histograms and their scatters run
+  /// in parallel, each block writing the ranges reserved to it.
+  void radixSort (vector<unsigned long long> & keys, unsigned int firstBit, unsigned int lastBit) {
+    unsigned int n = keys.size ();
+    unsigned int numBlocks = min (4 * ThreadPool::instance ().size (), max (1u, n / 4096));
+    unsigned int blockSize = (n + numBlocks - 1) / numBlocks;
+    vector<unsigned long long> sorted (n);
+    vector<unsigned int> offsets (numBlocks * RADIX);
+    for (unsigned int shift = firstBit; shift < lastBit; shift += RADIX_BITS) {
+      parallelFor (numBlocks, 1, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int b = begin; b < end; b++) {
+          unsigned int * count = &offsets[b * RADIX];
+          fill (count, count + RADIX, 0);
+          for (unsigned int i = b * blockSize; i < min (n, (b + 1) * blockSize); i++)
+            count[(keys[i] >> shift) & (RADIX - 1)]++;
+        }
+      });
+      // Digit major, block minor: the blocks keep their order within a digit
+      unsigned int sum = 0;
+      for (unsigned int d = 0; d < RADIX; d++)
+        for (unsigned int b = 0; b < numBlocks; b++) {
+          unsigned int count = offsets[b * RADIX + d];
+          offsets[b * RADIX + d] = sum;
+          sum += count;
+        }
+      parallelFor (numBlocks, 1, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int b = begin; b < end; b++) {
+          unsigned int * offset = &offsets[b * RADIX];
+          for (unsigned int i = b * blockSize; i < min (n, (b + 1) * blockSize); i++)
+            sorted[offset[(keys[i] >> shift) & (RADIX - 1)]++] = keys[i];
+        }
+      });
+      keys.swap (sorted);
+    }
+  }
+}
+
+void HalfEdges::build (const Mesh & mesh) {
+  PROFILE_ZONE ("HalfEdges::build");
+  const unsigned int * indices = mesh.indices ();
+  unsigned int numHalfEdges = 3 * mesh.T.size ();
+  unsigned int numVertices = mesh.positions.size ();
+  if (numHalfEdges == 0) {
+    opposite.clear ();
+    vertexHalfEdge.assign (numVertices, NONE);
+    return;
+  }
+
+  // One word per half-edge: the smallest vertex of its edge above the index of
+  // the half-edge (at most 32 + 32 bits). After the sort, the half-edges of the
+  // edges starting from each vertex are consecutive.
+  unsigned int halfEdgeBits = bitsOf (numHalfEdges);
+  unsigned long long halfEdgeMask = (1ull << halfEdgeBits) - 1;
+  vector<unsigned long long> keys (numHalfEdges);
+  parallelFor (numHalfEdges, 16384, [&] (unsigned int begin, unsigned int end) {
+    for (unsigned int h = begin; h < end; h++)
+      keys[h] = (unsigned long long) min (indices[h], indices[next (h)]) << halfEdgeBits | h;
+  });
+  radixSort (keys, halfEdgeBits, halfEdgeBits + bitsOf (numVertices));
+
+  // Each task matches the half-edges of its vertices, sorted on their other vertex.
+  // An edge is paired when it has exactly two half-edges, of opposite directions.
+  opposite.assign (numHalfEdges, NONE);
+  parallelFor (numVertices, 4096, [&] (unsigned int begin, unsigned int end) {
+    vector<unsigned long long>::iterator first = lower_bound (keys.begin (), keys.end (),
+                                                              (unsigned long long) begin << halfEdgeBits);
+    vector<unsigned long long>::iterator last = end == numVertices ? keys.end ()
+      : lower_bound (first, keys.end (), (unsigned long long) end << halfEdgeBits);
+    auto other = [&] (unsigned long long key) {
+      unsigned int h = key & halfEdgeMask;
+      return max (indices[h], indices[next (h)]);
+    };
+    while (first != last) {
+      vector<unsigned long long>::iterator run = first + 1;
+      while (run != last && *run >> halfEdgeBits == *first >> halfEdgeBits)
+        run++;
+      sort (first, run, [&] (unsigned long long a, unsigned long long b) {
+        return other (a) < other (b) || (other (a) == other (b) && a < b);
+      });
+      for (vector<unsigned long long>::iterator e = first; e != run; ) {
+        vector<unsigned long long>::iterator f = e + 1;
+        while (f != run && other (*f) == other (*e))
+          f++;
+        unsigned int h0 = *e & halfEdgeMask, h1 = f - e == 2 ? *(e + 1) & halfEdgeMask : NONE;
+        if (h1 != NONE && indices[h0] != indices[h1]) {
+          opposite[h0] = h1;
+          opposite[h1] = h0;
+        }
+        e = f;
+      }
+      first = run;
+    }
+  });
+
+  // Outgoing half-edge of each vertex, from its incident triangles
+  vertexHalfEdge.assign (numVertices, NONE);
+  parallelFor (numVertices, 4096, [&] (unsigned int begin, unsigned int end) {
+    for (unsigned int v = begin; v < end; v++)
+      for (unsigned int k = mesh.vertexTriangleOffsets[v]; k < mesh.vertexTriangleOffsets[v + 1]; k++) {
+        unsigned int t = mesh.vertexTriangles[k];
+        unsigned int h = 3 * t + (indices[3 * t] == v ? 0 : (indices[3 * t + 1] == v ? 1 : 2));
+        if (vertexHalfEdge[v] == NONE || opposite[h] == NONE)
+          vertexHalfEdge[v] = h;
+        if (opposite[h] == NONE)
+          break;
+      }
+  });
+}
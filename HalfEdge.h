@@ -0,0 +1,59 @@
+#ifndef HALF_EDGE_H
+#define HALF_EDGE_H
+
+#include <vector>
+#include "Mesh.h"
+
+/// Half-edge connectivity of the triangles of a mesh, in flat arrays of 32-bit
+/// indices. The half-edge h = 3 t + j of the triangle t goes from its corner j
+/// to its corner (j + 1) % 3: next, previous, triangle and origin are implicit,
+/// only the opposite half-edges and one outgoing half-edge per vertex are stored.
+///
+/// The half-edges are matched by sorting them on their edge (radix sort, in
+/// parallel). An edge is paired when it has exactly two half-edges of opposite
+/// directions; the others (borders, non-manifold or inconsistently oriented
+/// edges) have no opposite.
+class HalfEdges {
+ public:
+  static const unsigned int NONE = ~0u;
+
+  std::vector<unsigned int> opposite;        // one per half-edge, NONE if unpaired
+  std::vector<unsigned int> vertexHalfEdge;  // one outgoing half-edge per vertex, unpaired if any, NONE if isolated
+
+  /// Builds the connectivity of mesh.T. Uses the vertex to triangle adjacency of
+  /// the mesh, which must be up to date (see Mesh::updateVertexTriangles).
+  void build (const Mesh & mesh);
+
+  inline unsigned int size () const { return opposite.size (); }
+
+  static inline unsigned int triangle (unsigned int h) { return h / 3; }
+  static inline unsigned int next (unsigned int h) { return h % 3 == 2 ? h - 2 : h + 1; }
+  static inline unsigned int prev (unsigned int h) { return h % 3 == 0 ? h + 2 : h - 1; }
+  static inline unsigned int origin (const Mesh & mesh, unsigned int h) { return mesh.indices ()[h]; }
+  static inline unsigned int target (const Mesh & mesh, unsigned int h) { return mesh.indices ()[next (h)]; }
+
+  /// Outgoing half-edges of the vertex v, each in constant time:
+  /// for (h = firstOutgoing (v); h != NONE; h = nextOutgoing (v, h)). Around a
+  /// border, they start from the border and end at the other side; a
+  /// non-manifold vertex only gives the fan of vertexHalfEdge[v].
+  inline unsigned int firstOutgoing (unsigned int v) const { return vertexHalfEdge[v]; }
+  inline unsigned int nextOutgoing (unsigned int v, unsigned int h) const {
+    unsigned int o = opposite[prev (h)];
+    return o == vertexHalfEdge[v] ? NONE : o;
+  }
+
+  /// Calls f (w) for each vertex w of the one-ring of v
+  template <class Function>
+  void forEachNeighbor (const Mesh & mesh, unsigned int v, Function f) const {
+    unsigned int last = NONE;
+    for (unsigned int h = firstOutgoing (v); h != NONE; h = nextOutgoing (v, h)) {
+      f (target (mesh, h));
+      last = h;
+    }
+    // Around a border, the last neighbor ends the last triangle
+    if (last != NONE && opposite[prev (last)] == NONE)
+      f (origin (mesh, prev (last)));
+  }
+};
+
+#endif
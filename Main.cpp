@@ -13,18 +13,36 @@
 #include <cstdlib>
 #include <algorithm>
 #include <cmath>
+#include <fstream>
+#include <cstring>
 #include <GL/glut.h>
 
 #include "Vec3.h"
 #include "Camera.h"
 #include "Mesh.h"
 #include "Ray.h"
+#include "BSH.h"
+#include "BVH.h"
+#include "MeshCache.h"
+#include "AmbientOcclusion.h"
+#include "Shading.h"
+#include "BRDFBatch.h"
+#include "BRDFTable.h"
+#include "Renderer.h"
+#include "Parallel.h"
+#include "Profiler.h"
+#include "RayStats.h"
 
 using namespace std;
 
 static const unsigned int DEFAULT_SCREENWIDTH = 1024;
 static const unsigned int DEFAULT_SCREENHEIGHT = 768;
 static const string DEFAULT_MESH_FILE ("models/man.off");
+static const string DEFAULT_CAMERA_FILE ("camera.txt");
+static const string DEFAULT_TRACE_FILE ("trace.json");
+// Relative error allowed to the exponentials of the batch BRDF kernels, far
+// below the 8 bits of the displayed colors
+static const float SHADING_MAX_ERROR = 1e-4f;
 
 static string appTitle ("Informatique Graphique & Realite Virtuelle - Travaux Pratiques - Algorithmes de Rendu");
 static GLint window;
@@ -33,11 +51,19 @@ static bool fullScreen = false;
 
 static Camera camera;
 static Mesh mesh;
+static BSH bsh;
+static BVH bvh;
+static AmbientOcclusion ao;
+
+// Ray queries of the frames of the current second, reported on stderr with 'i'
+static RayStats rayStats;
+static bool rayStatsReport = false;
 
-#define BRDF_BLINN_PHONG 0
-#define BRDF_COOK_TORRANCE 1
-#define BRDF_GGX 2
 static int brdf_method = BRDF_BLINN_PHONG;
+// Lookup tables of the microfacet terms instead of the analytic BRDF, rebuilt
+// when the BRDF changes
+static bool brdf_tables = false;
+static BRDFTable brdfTable;
 
 #define COLOR_BRDF 0
 #define COLOR_AMBIENT_OCCLUSION 1
@@ -46,6 +72,7 @@ static int color_method = COLOR_BRDF;
 #define SHADOW_OFF 0
 #define SHADOW_INTERSECTION 1
 #define SHADOW_BSH 2
+#define SHADOW_BRUTE_FORCE 3
 static int shadow_method = SHADOW_OFF;
 
 
@@ -53,18 +80,30 @@ void printUsage () {
 	std::cerr << std::endl
             << appTitle << std::endl
             << "Author: Tamy Boubekeur" << std::endl << std::endl
-            << "Usage: ./main [<file.off>]" << std::endl
+            << "Usage: ./main [--profile] [--reorder] [<file.off>]" << std::endl
+            << "       ./main --render <out.ppm> [--size <W>x<H>] [--camera <camera.txt>]" << std::endl
+            << "              [--brdf <0|1|2>] [--no-shadows] [--ao <samples>] [--trace <trace.json>]" << std::endl
+            << "              [--reorder] [--compact] [<file.off>]" << std::endl
             << "Commands:" << std::endl
             << "------------------" << std::endl
             << " ?: Print help" << std::endl
             << " w: Toggle wireframe mode" << std::endl
+            << " s: Switch shadow method" << std::endl
+            << " b: Switch BRDF" << std::endl
+            << " t: Toggle the lookup tables of the BRDF terms" << std::endl
+            << " c: Switch between BRDF and ambient occlusion" << std::endl
+            << " +/-: Double/halve the ambient occlusion samples per vertex" << std::endl
+            << " v: Save the camera to " << DEFAULT_CAMERA_FILE << " (for --render --camera)" << std::endl
+            << " i: Toggle the report of ray queries per frame" << std::endl
+            << " p: Toggle profiling, the trace is saved to " << DEFAULT_TRACE_FILE << " when stopped" << std::endl
             << " <drag>+<left button>: rotate model" << std::endl
             << " <drag>+<right button>: move model" << std::endl
             << " <drag>+<middle button>: zoom" << std::endl
             << " q, <esc>: Quit" << std::endl << std::endl;
 }
 
-void init (const char * modelFilename) {
+void init (const char * modelFilename, bool reorder) {
+  PROFILE_ZONE ("init");
   glCullFace (GL_BACK);     // Specifies the faces to cull (here the ones pointing away from the camera)
   glEnable (GL_CULL_FACE); // Enables face culling (based on the orientation defined by the CW/CCW enumeration).
   glDepthFunc (GL_LESS); // Specify the depth test for the z-buffer
@@ -73,187 +112,191 @@ void init (const char * modelFilename) {
   glClearColor (0.0f, 0.0f, 0.0f, 1.0f); // Background color
   glClearColor (0.0f, 0.0f, 0.0f, 1.0f);
 
-  mesh.loadOFF (modelFilename);
+  if (!MeshCache::loadOrBuild (modelFilename, mesh, bvh, reorder))
+    exit (1);
+  mesh.initGLBuffers ();
+  bsh.build (mesh);
+  ao.reset (mesh);
   camera.resize (DEFAULT_SCREENWIDTH, DEFAULT_SCREENHEIGHT);
 }
 
-void drawScene () {
-  glBegin (GL_TRIANGLES);
-  for (unsigned int i = 0; i < mesh.T.size (); i++)
-    for (unsigned int j = 0; j < 3; j++) {
-      const Vertex & v = mesh.V[mesh.T[i].v[j]];
-      // EXERCISE : the following color response shall be replaced with a proper reflectance evaluation/shadow test/etc.
-
-      Vec3<float> light_pos = Vec3<float>(0.0f, 1.0f, 0.0f);
-      // Create a Ray going out of the current vertex
-      // The paramethers for creating this Ray class are
-      // The evaluated point coordinates and the light source coordinates
-      Ray out_ray = Ray(v.p[0], v.p[1], v.p[2], light_pos[0], light_pos[1], light_pos[2]);
-
-      // Flag used to evaluate if the vertex will be drawn or not
-      int draw_vertex = 1;
-
-      switch (shadow_method){
-      case SHADOW_OFF:
-        // Do nothing
-        break;
-      case SHADOW_INTERSECTION:
-        // Try to calculate the intersection between an emitted ray an any triangle
-        for (unsigned int k = 0; k < mesh.T.size (); k++){
-          // Avoid self intersection evaluation
-          if (k != i){
-            const Vertex & v0 = mesh.V[mesh.T[k].v[0]];
-            const Vertex & v1 = mesh.V[mesh.T[k].v[1]];
-            const Vertex & v2 = mesh.V[mesh.T[k].v[2]];
-
-            Vec3<float> vec_v0 = Vec3<float>(v0.p[0], v0.p[1], v0.p[2]);
-            Vec3<float> vec_v1 = Vec3<float>(v1.p[0], v1.p[1], v1.p[2]);
-            Vec3<float> vec_v2 = Vec3<float>(v2.p[0], v2.p[1], v2.p[2]);
-
-            if (out_ray.intersect(vec_v0, vec_v1, vec_v2)){
-              draw_vertex = 0;
-              break;
-            }
-          }
+// Lighting cache, one entry per vertex of the mesh. Shadows only depend on the
+// mesh and the light, while the BRDF also depends on the camera position.
+static Vec3<float> light_pos = Vec3<float>(0.0f, 1.0f, 0.0f);
+static std::vector<signed char> vertexVisibility; // -1 when not evaluated yet
+static std::vector<float> vertexBRDF;
+static bool brdfValid = false; // the BRDF is evaluated for all the vertices at once
+static std::vector<Vec3<float> > vertexColors;
+
+// Cache keys
+static int cachedShadowMethod = -1;
+static int cachedBrdfMethod = -1;
+static bool cachedBrdfTables = false;
+static unsigned int cachedCameraMoves = 0;
+static Vec3<float> cachedLightPos;
+
+// Invalidates the cache entries whose inputs changed since the last frame
+void updateLightingCache () {
+  bool meshChanged = vertexVisibility.size () != mesh.V.size ();
+  bool lightChanged = meshChanged || cachedLightPos != light_pos;
+  if (meshChanged) {
+    vertexVisibility.resize (mesh.V.size ());
+    vertexBRDF.resize (mesh.V.size ());
+    vertexColors.resize (mesh.V.size ());
+  }
+  if (lightChanged || cachedShadowMethod != shadow_method)
+    std::fill (vertexVisibility.begin (), vertexVisibility.end (), -1);
+  if (lightChanged || cachedBrdfMethod != brdf_method || cachedBrdfTables != brdf_tables
+      || cachedCameraMoves != camera.getMoveCount ())
+    brdfValid = false;
+  cachedShadowMethod = shadow_method;
+  cachedBrdfMethod = brdf_method;
+  cachedBrdfTables = brdf_tables;
+  cachedCameraMoves = camera.getMoveCount ();
+  cachedLightPos = light_pos;
+}
+
+// Returns 1 if the light is visible from the vertex of index i. The triangles
+// incident to the vertex are never tested, so that the ray does not hit the
+// surface it leaves from. One instantiation per shadow method, the switch is
+// resolved at compile time.
+template <int SHADOW_METHOD>
+int evaluateVisibility (unsigned int i) {
+  const Vertex & v = mesh.V[i];
+
+  // Create a Ray going out of the current vertex
+  // The paramethers for creating this Ray class are
+  // The evaluated point coordinates and the light source coordinates
+  Ray out_ray = Ray(v.p[0], v.p[1], v.p[2], light_pos[0], light_pos[1], light_pos[2]);
+
+  // Flag used to evaluate if the vertex will be drawn or not
+  int draw_vertex = 1;
+
+  switch (SHADOW_METHOD){
+  case SHADOW_OFF:
+    // Do nothing
+    break;
+  case SHADOW_INTERSECTION:
+    // The BVH only tests the triangles whose boxes are crossed by the ray
+    if (bvh.anyHit(out_ray, mesh, i))
+      draw_vertex = 0;
+    break;
+  case SHADOW_BRUTE_FORCE:
+    {
+    // Reference: try to calculate the intersection between an emitted ray an any triangle
+    RayQuery query;
+    for (unsigned int k = 0; k < mesh.records.size (); k++){
+      // Avoid self intersection evaluation
+      if (!mesh.records[k].contains(i)){
+        // The precomputed edges and normal of the triangle, its vertices are not read
+        query.triangleTests++;
+        if (out_ray.intersect(mesh.records[k])){
+          draw_vertex = 0;
+          query.hit = 1;
+          break;
         }
-        break;
-      case SHADOW_BSH:
-        // Not implemented yet
-        break;
-      default:
-        std::cerr << "Shadow: ERROR" << std::endl;
-        break;
       }
+    }
+    break;
+    }
+  case SHADOW_BSH:
+    // Only the triangles inside the spheres crossed by the ray are tested
+    if (bsh.intersect(out_ray, mesh, i))
+      draw_vertex = 0;
+    break;
+  }
+  return draw_vertex;
+}
 
-      // If after shadow evaluation the vertex is still valid, we calculate the
-      // BRDF color
-      if(draw_vertex){
-        switch (color_method){
-        case COLOR_BRDF:
-          {
-          Vec3<float> normal = Vec3<float>(v.n[0], v.n[1], v.n[2]);
-          normal.normalize();
-          Vec3<float> light_dir = Vec3<float>(light_pos[0] -v.p[0],
-                                              light_pos[1] -v.p[1],
-                                              light_pos[2] -v.p[2]);
-          light_dir.normalize();
-
-          float cam_x, cam_y, cam_z;
-          camera.getPos(cam_x, cam_y, cam_z);
-          Vec3<float> camera_dir = Vec3<float>(cam_x - v.p[0], cam_y- v.p[1], cam_z- v.p[2]);
-          camera_dir.normalize();
-
-          float Kd = 0.7f;
-          float diffuse_term = Kd/3.14f;
-
-          // Variables for BRDF calculus
-          float specular_term;
-          // Variables for Blinn Phong
-          Vec3<float> r;
-          // Variables for Cook Torrance and GGX
-          Vec3<float> Wh;
-          float D;
-          float F;
-          float Gi;
-          float Go;
-          float G;
-
-          //
-
-          // Paramethers for BRDF calculus
-          // Paramethers for Blinn Phong
-          float Ks = 0.5f;
-          float S = 0.5f;
-          // Paramethers for Cook Torrance and GGX
-          float alpha = 0.7f;
-          float F0 = 0.04f;
-
-
-          switch(brdf_method){
-          case BRDF_BLINN_PHONG:
-
-            r = 2.0f * normal * dot(normal, light_dir) - light_dir;
-            specular_term = Ks * pow(dot(r, camera_dir), S);
-
-            break;
-          case BRDF_COOK_TORRANCE:
-
-            Wh = camera_dir + light_dir;
-            Wh.normalize();
-
-            D = 1.0f/(3.14f * pow(alpha, 2) * pow(dot(normal, Wh), 4));
-            D *= exp((pow(dot(normal, Wh), 2) -1)/(pow(alpha, 2) * pow(dot(normal, Wh), 2)));
-
-            F = F0 + (1.0f - F0) * pow((1.0f - max(0.0f, dot(light_dir, Wh))), 5);
-
-            G = min(
-                          min(1.0f,
-                              2.0f * dot(normal, Wh) * dot(normal, light_dir) / dot(camera_dir, Wh)
-                              ),
-                          2.0f * dot(normal, Wh) * dot(normal, camera_dir) / dot(camera_dir, Wh)
-                          );
-
-            specular_term = D * F * G;
-            specular_term /= 4.0f * dot(normal, light_dir) * dot(normal, camera_dir);
-
-            break;
-          case BRDF_GGX:
-
-            Wh = camera_dir + light_dir;
-            Wh.normalize();
-
-            D = pow(alpha, 2) / 3.14f;
-            D /= pow(1 + (pow(alpha, 2) - 1) * pow(dot(normal, Wh), 2), 2);
-
-            F = F0 + (1.0f - F0) * pow((1.0f - max(0.0f, dot(light_dir, Wh))), 5);
-
-            Gi = 2.0f * dot(normal, light_dir);
-            Gi /= dot(normal, light_dir) +
-              pow(pow(alpha, 2) + (1.0f - pow(alpha, 2)) * pow(dot(normal, light_dir), 2), 0.5);
-
-            Go = 2.0f * dot(normal, camera_dir);
-            Gi /= dot(normal, camera_dir) +
-              pow(pow(alpha, 2) + (1.0f - pow(alpha, 2)) * pow(dot(normal, camera_dir), 2), 0.5);
-
-            G = Gi * Go;
-
-            specular_term = D * F * G;
-            specular_term /= 4.0f * dot(normal, light_dir) * dot(normal, camera_dir);
+// Shadow pass over the vertices [begin, end) not evaluated yet
+template <int SHADOW_METHOD>
+void evaluateVisibilityRange (unsigned int begin, unsigned int end) {
+  for (unsigned int i = begin; i < end; i++)
+    if (vertexVisibility[i] < 0)
+      vertexVisibility[i] = evaluateVisibility<SHADOW_METHOD> (i);
+}
 
-            break;
-          default:
-            std::cerr << "BRDF: ERROR" << std::endl;
-            diffuse_term = 0.0f;
-            specular_term = 0.0f;
-            break;
-          }
-
-          float BRDF = 1.0f * (diffuse_term + specular_term) * (dot(normal, light_dir));
-          glColor3f (BRDF, BRDF, BRDF);
+typedef void (*VisibilityKernel) (unsigned int begin, unsigned int end);
+
+// The shadow pass of a shadow method, selected once per frame
+VisibilityKernel visibilityKernel (int method) {
+  switch (method) {
+  case SHADOW_INTERSECTION:
+    return evaluateVisibilityRange<SHADOW_INTERSECTION>;
+  case SHADOW_BSH:
+    return evaluateVisibilityRange<SHADOW_BSH>;
+  case SHADOW_BRUTE_FORCE:
+    return evaluateVisibilityRange<SHADOW_BRUTE_FORCE>;
+  case SHADOW_OFF:
+    return evaluateVisibilityRange<SHADOW_OFF>;
+  default:
+    std::cerr << "Shadow: ERROR" << std::endl;
+    return evaluateVisibilityRange<SHADOW_OFF>;
+  }
+}
 
-          break;
-          }
-        case COLOR_AMBIENT_OCCLUSION:
-          {
-          glColor3f (0.0f, 0.0f, 0.0f);
-          break;
-          }
-        default:
-          {
-          std::cerr << "COLOR: ERROR" << std::endl;
-          break;
-          }
-        }
+// Evaluates the color of every vertex of the mesh once, using the lighting cache
+void shadeVertices () {
+  updateLightingCache ();
+  Vec3<float> cam_pos;
+  camera.getPos(cam_pos);
+
+  // Ambient occlusion converges over the frames, a few rays per vertex at a time
+  if (color_method == COLOR_AMBIENT_OCCLUSION)
+    ao.refine (mesh, bvh);
+
+  // The modes are resolved here, once per frame: the passes below run kernels
+  // instantiated for them, without any switch in their loops
+  VisibilityKernel visibility = visibilityKernel (shadow_method);
+  BRDFKernel brdf = brdfBatchKernel (brdf_method, SHADING_MAX_ERROR);
+  bool evaluateBRDFs = color_method == COLOR_BRDF && !brdfValid;
+  if (evaluateBRDFs && brdf_tables && brdfTable.brdf () != brdf_method)
+    brdfTable.build (brdf_method);
+
+  // Vertices are independent: the passes are split in chunks over all the cores.
+  // Shadows first, in their own pass so that they are timed apart from the BRDF.
+  parallelFor (mesh.V.size (), 256, [&] (unsigned int begin, unsigned int end) {
+    PROFILE_ZONE ("shadows");
+    visibility (begin, end);
+  });
+
+  parallelFor (mesh.V.size (), 256, [&] (unsigned int begin, unsigned int end) {
+    PROFILE_ZONE ("shading");
+    switch (color_method){
+    case COLOR_BRDF:
+      // The BRDF of the vertices in the shadow as well, so that the loop has no branch
+      if (evaluateBRDFs && brdf_tables)
+        brdfTable.evaluateRange (&mesh.positions[0], &mesh.normals[0], light_pos, cam_pos, begin, end, &vertexBRDF[0]);
+      else if (evaluateBRDFs)
+        brdf (&mesh.positions[0], &mesh.normals[0], light_pos, cam_pos, begin, end, &vertexBRDF[0]);
+      for (unsigned int i = begin; i < end; i++) {
+        float BRDF = vertexVisibility[i] ? vertexBRDF[i] : 0.0f;
+        vertexColors[i] = Vec3<float>(BRDF, BRDF, BRDF);
       }
-      else{
-        // std::cerr << "Shadow Place!!" << std::endl;
-        glColor3f (0.0f, 0.0f, 0.0f);
+      break;
+    case COLOR_AMBIENT_OCCLUSION:
+      for (unsigned int i = begin; i < end; i++) {
+        float A = vertexVisibility[i] ? ao.accessibility(i) : 0.0f;
+        vertexColors[i] = Vec3<float>(A, A, A);
       }
-
-      glNormal3f (v.n[0], v.n[1], v.n[2]); // Specifies current normal vertex
-      glVertex3f (v.p[0], v.p[1], v.p[2]); // Emit a vertex (one triangle is emitted each time 3 vertices are emitted)
+      break;
+    default:
+      std::cerr << "COLOR: ERROR" << std::endl;
+      break;
     }
-  glEnd ();
+  });
+  if (evaluateBRDFs)
+    brdfValid = true;
+}
+
+void drawScene () {
+  PROFILE_ZONE ("drawScene");
+  shadeVertices ();
+
+  // Positions, normals and indices already are on the GPU, only the colors are sent
+  PROFILE_ZONE ("GL submission");
+  mesh.updateGLColors (vertexColors);
+  mesh.drawGL ();
 }
 
 void reshape(int w, int h) {
@@ -261,11 +304,14 @@ void reshape(int w, int h) {
 }
 
 void display () {
+  PROFILE_ZONE ("display");
   glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
   camera.apply ();
   drawScene ();
   glFlush ();
   glutSwapBuffers ();
+  // The passes are over, the counters of all threads can be merged
+  rayStats += RayStats::collect ();
 }
 
 void key (unsigned char keyPressed, int x, int y) {
@@ -280,7 +326,7 @@ void key (unsigned char keyPressed, int x, int y) {
     }
     break;
   case 's':
-    shadow_method = (shadow_method +1)%3;
+    shadow_method = (shadow_method +1)%4;
     switch (shadow_method){
     case SHADOW_OFF:
       std::cerr << "Shadow: Off" << std::endl;
@@ -291,6 +337,9 @@ void key (unsigned char keyPressed, int x, int y) {
     case SHADOW_BSH:
       std::cerr << "Shadow: BSH" << std::endl;
       break;
+    case SHADOW_BRUTE_FORCE:
+      std::cerr << "Shadow: Brute Force" << std::endl;
+      break;
     default:
       std::cerr << "Shadow: Unrecognized Shadow Method" << std::endl;
       break;
@@ -313,6 +362,10 @@ void key (unsigned char keyPressed, int x, int y) {
       break;
     }
     break;
+  case 't':
+    brdf_tables = !brdf_tables;
+    std::cerr << "BRDF tables: " << (brdf_tables ? "On" : "Off") << std::endl;
+    break;
   case 'c':
     color_method = (color_method +1)%2;
     switch (color_method){
@@ -327,6 +380,32 @@ void key (unsigned char keyPressed, int x, int y) {
       break;
     }
     break;
+  case '+':
+  case '-':
+    ao.numSamples = keyPressed == '+' ? 2 * ao.numSamples : std::max (1u, ao.numSamples / 2);
+    ao.reset (mesh);
+    std::cerr << "AO: " << ao.numSamples << " samples per vertex" << std::endl;
+    break;
+  case 'v':
+    {
+    std::ofstream out (DEFAULT_CAMERA_FILE.c_str ());
+    camera.write (out);
+    std::cerr << "Camera saved to " << DEFAULT_CAMERA_FILE << std::endl;
+    break;
+    }
+  case 'i':
+    rayStatsReport = !rayStatsReport;
+    std::cerr << "Ray statistics: " << (rayStatsReport ? "On" : "Off") << std::endl;
+    break;
+  case 'p':
+    Profiler::setEnabled (!Profiler::isEnabled ());
+    if (Profiler::isEnabled ())
+      std::cerr << "Profiling: On" << std::endl;
+    else if (Profiler::writeChromeTrace (DEFAULT_TRACE_FILE))
+      std::cerr << "Profiling: Off, trace saved to " << DEFAULT_TRACE_FILE << std::endl;
+    else
+      std::cerr << DEFAULT_TRACE_FILE << ": cannot write the trace" << std::endl;
+    break;
   case 'q':
   case 27:
     exit (0);
@@ -358,17 +437,138 @@ void idle () {
   float currentTime = glutGet ((GLenum)GLUT_ELAPSED_TIME);
   if (currentTime - lastTime >= 1000.0f) {
     FPS = counter;
+    // Per-phase breakdown of the frames of the last second
+    static unsigned long long lastProfile = 0;
+    if (Profiler::isEnabled ())
+      Profiler::printPhases (std::cerr, lastProfile, counter);
+    lastProfile = Profiler::now ();
+    if (rayStatsReport)
+      rayStats.print (std::cerr, counter);
+    rayStats.clear ();
     counter = 0;
     static char winTitle [128];
     unsigned int numOfTriangles = mesh.T.size ();
-    sprintf (winTitle, "Number Of Triangles: %d - FPS: %d", numOfTriangles, FPS);
+    if (color_method == COLOR_AMBIENT_OCCLUSION)
+      sprintf (winTitle, "Number Of Triangles: %d - FPS: %d - AO: %d/%d samples", numOfTriangles, FPS,
+               ao.samples (), ao.numSamples);
+    else
+      sprintf (winTitle, "Number Of Triangles: %d - FPS: %d", numOfTriangles, FPS);
     glutSetWindowTitle (winTitle);
     lastTime = currentTime;
   }
   glutPostRedisplay ();
 }
 
+// Ray traces the mesh, with ambient occlusion if aoSamples > 0, and writes the image
+template <class MeshType>
+int renderImage (const MeshType & mesh, Renderer & renderer, unsigned int aoSamples,
+                 const string & output, const string & traceFilename) {
+  if (aoSamples > 0) {
+    ao.numSamples = aoSamples;
+    ao.reset (mesh);
+    while (ao.refine (mesh, bvh));
+    renderer.vertexWeights.resize (mesh.numVertices ());
+    for (unsigned int i = 0; i < mesh.numVertices (); i++)
+      renderer.vertexWeights[i] = ao.accessibility (i);
+  }
+
+  std::vector<Vec3<float> > image;
+  float start = clock () / float (CLOCKS_PER_SEC);
+  RayStats::collect ();
+  renderer.render (mesh, bvh, camera, image);
+  std::cerr << output << ": " << renderer.width << "x" << renderer.height << " rendered in "
+            << clock () / float (CLOCKS_PER_SEC) - start << " s (CPU time)" << std::endl;
+  RayStats::collect ().print (std::cerr);
+  if (!Renderer::writePPM (output, renderer.width, renderer.height, image)) {
+    std::cerr << output << ": cannot write the image" << std::endl;
+    return 1;
+  }
+  if (Profiler::isEnabled ()) {
+    Profiler::printPhases (std::cerr, 0, 1);
+    if (!Profiler::writeChromeTrace (traceFilename)) {
+      std::cerr << traceFilename << ": cannot write the trace" << std::endl;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Headless mode: ray traces one image without opening any window
+int renderMain (int argc, char ** argv) {
+  Renderer renderer;
+  string output = argv[2];
+  string modelFilename = DEFAULT_MESH_FILE;
+  string cameraFilename;
+  string traceFilename;
+  unsigned int aoSamples = 0;
+  bool reorder = false;
+  bool compact = false;
+  for (int i = 3; i < argc; i++) {
+    if (strcmp (argv[i], "--size") == 0 && i + 1 < argc) {
+      if (sscanf (argv[++i], "%ux%u", &renderer.width, &renderer.height) != 2
+          || renderer.width == 0 || renderer.height == 0) {
+        printUsage ();
+        return 1;
+      }
+    } else if (strcmp (argv[i], "--camera") == 0 && i + 1 < argc)
+      cameraFilename = argv[++i];
+    else if (strcmp (argv[i], "--brdf") == 0 && i + 1 < argc)
+      renderer.brdf = atoi (argv[++i]) % 3;
+    else if (strcmp (argv[i], "--no-shadows") == 0)
+      renderer.shadows = false;
+    else if (strcmp (argv[i], "--ao") == 0 && i + 1 < argc)
+      aoSamples = atoi (argv[++i]);
+    else if (strcmp (argv[i], "--trace") == 0 && i + 1 < argc)
+      traceFilename = argv[++i];
+    else if (strcmp (argv[i], "--reorder") == 0)
+      reorder = true;
+    else if (strcmp (argv[i], "--compact") == 0)
+      compact = true;
+    else if (argv[i][0] != '-')
+      modelFilename = argv[i];
+    else {
+      printUsage ();
+      return 1;
+    }
+  }
+
+  Profiler::setEnabled (!traceFilename.empty ());
+  if (!cameraFilename.empty ()) {
+    std::ifstream in (cameraFilename.c_str ());
+    if (!camera.read (in)) {
+      std::cerr << cameraFilename << ": cannot read the camera" << std::endl;
+      return 1;
+    }
+  }
+  // The image size sets the aspect ratio, not the window the camera was saved from
+  camera.setAspectRatio (float (renderer.width) / float (renderer.height));
+  if (compact) {
+    // Quantized vertices and indices, without the float arrays and packets
+    CompactMesh compactMesh;
+    if (!MeshCache::loadCompact (modelFilename, compactMesh, bvh, reorder))
+      return 1;
+    std::cerr << modelFilename << ": compact mesh " << compactMesh.memoryBytes () << " bytes, BVH "
+              << bvh.memoryBytes () << " bytes" << std::endl;
+    return renderImage (compactMesh, renderer, aoSamples, output, traceFilename);
+  }
+  if (!MeshCache::loadOrBuild (modelFilename, mesh, bvh, reorder))
+    return 1;
+  return renderImage (mesh, renderer, aoSamples, output, traceFilename);
+}
+
 int main (int argc, char ** argv) {
+  if (argc > 2 && strcmp (argv[1], "--render") == 0)
+    return renderMain (argc, argv);
+  bool reorder = false;
+  while (argc > 1 && (strcmp (argv[1], "--profile") == 0 || strcmp (argv[1], "--reorder") == 0)) {
+    if (strcmp (argv[1], "--profile") == 0)
+      Profiler::setEnabled (true);
+    else
+      reorder = true;
+    argv[1] = argv[0];
+    argc--;
+    argv++;
+  }
   if (argc > 2) {
     printUsage ();
     exit (1);
@@ -377,7 +577,7 @@ int main (int argc, char ** argv) {
   glutInitDisplayMode (GLUT_RGBA | GLUT_DEPTH | GLUT_DOUBLE);
   glutInitWindowSize (DEFAULT_SCREENWIDTH, DEFAULT_SCREENHEIGHT);
   window = glutCreateWindow (appTitle.c_str ());
-  init (argc == 2 ? argv[1] : DEFAULT_MESH_FILE.c_str ());
+  init (argc == 2 ? argv[1] : DEFAULT_MESH_FILE.c_str (), reorder);
   glutIdleFunc (idle);
   glutReshapeFunc (reshape);
   glutDisplayFunc (display);
@@ -17,61 +17,214 @@
 // --------------------------------------------------------------------------
 
 #include "Mesh.h"
+#include "OFFFile.h"
+#include "Parallel.h"
+#include "Profiler.h"
 #include <iostream>
-#include <fstream>
+#include <sstream>
 #include <cstdlib>
+#include <cstring>
 #include <string>
+#include <algorithm>
+#include <chrono>
+#include <type_traits>
 
 using namespace std;
 
-void Mesh::loadOFF (const std::string & filename) {
-	ifstream in (filename.c_str ());
-    if (!in) 
-        exit (1);
-	string offString;
-    unsigned int sizeV, sizeT, tmp;
-    in >> offString >> sizeV >> sizeT >> tmp;
-    V.resize (sizeV);
-    T.resize (sizeT);
-    for (unsigned int i = 0; i < sizeV; i++)
-        in >> V[i].p;
-    int s;
-    for (unsigned int i = 0; i < sizeT; i++) {
-        in >> s;
-        for (unsigned int j = 0; j < 3; j++)
-            in >> T[i].v[j];
+namespace {
+    // Angle of the triangle t at its corner i
+    float cornerAngle (const Vec3fArray & positions, const Triangle & t, unsigned int i) {
+        unsigned int j = t.v[0] == i ? 0 : (t.v[1] == i ? 1 : 2);
+        Vec3f a = normalize (positions[t.v[(j + 1) % 3]] - positions[i]);
+        Vec3f b = normalize (positions[t.v[(j + 2) % 3]] - positions[i]);
+        return acos (max (-1.0f, min (1.0f, dot (a, b))));
+    }
+}
+
+// The arrays of vertex attributes and triangles are copied and mapped as raw memory
+static_assert (std::is_trivially_copyable<Vec3f>::value, "Vec3f must be plain data");
+static_assert (std::is_trivially_copyable<Triangle>::value && sizeof (Triangle) == 3 * sizeof (unsigned int),
+               "Triangle must be three packed indices");
+
+bool Mesh::loadOFF (const std::string & filename) {
+    PROFILE_ZONE ("Mesh::loadOFF");
+    chrono::steady_clock::time_point start = chrono::steady_clock::now ();
+    MappedFile file (filename);
+    if (file.data == 0) {
+        cerr << filename << ": cannot read the file" << endl;
+        return false;
     }
-    in.close ();
+    OFFParser header (file.data, file.data + file.size);
+    string offString;
+    unsigned int sizeV, sizeT, sizeE;
+    if (!header.readWord (offString) || offString != "OFF"
+        || !header.readUInt (sizeV) || !header.readUInt (sizeT) || !header.readUInt (sizeE)) {
+        cerr << filename << ": not an OFF file (bad header)" << endl;
+        return false;
+    }
+    if (sizeV == 0) {
+        cerr << filename << ": the mesh has no vertex" << endl;
+        return false;
+    }
+    header.skipLine ();
+
+    // Locate the face section, so that vertices and faces can be parsed concurrently
+    OFFParser vertices = header;
+    OFFParser faces = header;
+    for (unsigned int i = 0; i < 3 * sizeV; i++)
+        if (!faces.skipToken ()) {
+            cerr << filename << ": " << sizeV << " vertices expected, only " << i / 3 << " found" << endl;
+            return false;
+        }
+    vertices.end = faces.p;
+
+    Vec3fArray newPositions (sizeV);
+    vector<Triangle> newT;
+    newT.reserve (sizeT);
+    string errors[2];
+    parallelFor (2, 1, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int task = begin; task < end; task++) {
+            ostringstream error;
+            if (task == 0) {
+                for (unsigned int i = 0; i < sizeV; i++) {
+                    Vec3f & p = newPositions[i];
+                    if (!vertices.readFloat (p[0]) || !vertices.readFloat (p[1]) || !vertices.readFloat (p[2])) {
+                        error << filename << ":" << vertices.line (file.data) << ": bad vertex " << i;
+                        break;
+                    }
+                }
+            } else {
+                // Polygons are split in fans of triangles
+                for (unsigned int i = 0; i < sizeT && error.tellp () == 0; i++) {
+                    unsigned int n, v0, v1, v2;
+                    if (!faces.readUInt (n) || n < 3
+                        || !faces.readUInt (v0) || !faces.readUInt (v2)) {
+                        error << filename << ":" << faces.line (file.data) << ": bad face " << i;
+                        break;
+                    }
+                    for (unsigned int j = 2; j < n; j++) {
+                        v1 = v2;
+                        if (!faces.readUInt (v2)) {
+                            error << filename << ":" << faces.line (file.data) << ": bad face " << i;
+                            break;
+                        }
+                        if (v0 >= sizeV || v1 >= sizeV || v2 >= sizeV) {
+                            error << filename << ":" << faces.line (file.data) << ": face " << i
+                                  << " has a vertex index out of range";
+                            break;
+                        }
+                        newT.push_back (Triangle (v0, v1, v2));
+                    }
+                }
+            }
+            errors[task] = error.str ();
+        }
+    });
+    for (unsigned int task = 0; task < 2; task++)
+        if (!errors[task].empty ()) {
+            cerr << errors[task] << endl;
+            return false;
+        }
+
+    positions.swap (newPositions);
+    normals.assign (sizeV, Vec3f ());
+    T.swap (newT);
+    updateVertexTriangles ();
+    double seconds = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
     centerAndScaleToUnit ();
     recomputeNormals ();
+    cerr << filename << ": " << V.size () << " vertices, " << T.size () << " triangles, "
+         << file.size / 1e6 << " MB parsed in " << seconds * 1e3 << " ms ("
+         << file.size / 1e6 / seconds << " MB/s)" << endl;
+    return true;
+}
+
+void Mesh::recomputeNormals (NormalWeighting weighting) {
+    PROFILE_ZONE ("Mesh::recomputeNormals");
+    if (vertexTriangleOffsets.size () != positions.size () + 1 || vertexTriangles.size () != 3 * T.size ())
+        updateVertexTriangles ();
+
+    // Triangle normals, unit or of length twice the area of the triangle
+    Vec3fArray triangleNormals (T.size ());
+    parallelFor (T.size (), 4096, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            Vec3f e01 = positions[T[i].v[1]] -  positions[T[i].v[0]];
+            Vec3f e02 = positions[T[i].v[2]] -  positions[T[i].v[0]];
+            Vec3f n = cross (e01, e02);
+            if (weighting != AREA_WEIGHTS)
+                n.normalize ();
+            triangleNormals[i] = n;
+        }
+    });
+
+    // Gather per vertex, each task writes its own normals only. The triangles
+    // are summed in increasing order, as a scatter over T would.
+    normals.resize (positions.size ());
+    parallelFor (positions.size (), 4096, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            Vec3f n (0.0f, 0.0f, 0.0f);
+            for (unsigned int k = vertexTriangleOffsets[i]; k < vertexTriangleOffsets[i + 1]; k++) {
+                unsigned int t = vertexTriangles[k];
+                if (weighting == ANGLE_WEIGHTS)
+                    n += cornerAngle (positions, T[t], i) * triangleNormals[t];
+                else
+                    n += triangleNormals[t];
+            }
+            n.normalize ();
+            normals[i] = n;
+        }
+    });
 }
 
-void Mesh::recomputeNormals () {
-    for (unsigned int i = 0; i < V.size (); i++)
-        V[i].n = Vec3f (0.0, 0.0, 0.0);
-    for (unsigned int i = 0; i < T.size (); i++) {
-        Vec3f e01 = V[T[i].v[1]].p -  V[T[i].v[0]].p;
-        Vec3f e02 = V[T[i].v[2]].p -  V[T[i].v[0]].p;
-        Vec3f n = cross (e01, e02);
-        n.normalize ();
+void Mesh::updateVertexTriangles () {
+    PROFILE_ZONE ("Mesh::updateVertexTriangles");
+    // Counting sort of the corners by vertex, stable so that the triangles of
+    // each vertex are in increasing order
+    vertexTriangleOffsets.assign (positions.size () + 1, 0);
+    for (unsigned int i = 0; i < T.size (); i++)
         for (unsigned int j = 0; j < 3; j++)
-            V[T[i].v[j]].n += n;
-    }
-    for (unsigned int i = 0; i < V.size (); i++)
-        V[i].n.normalize ();
+            vertexTriangleOffsets[T[i].v[j] + 1]++;
+    for (unsigned int i = 0; i < positions.size (); i++)
+        vertexTriangleOffsets[i + 1] += vertexTriangleOffsets[i];
+    vertexTriangles.resize (3 * T.size ());
+    vector<unsigned int> next (vertexTriangleOffsets.begin (), vertexTriangleOffsets.end () - 1);
+    for (unsigned int i = 0; i < T.size (); i++)
+        for (unsigned int j = 0; j < 3; j++)
+            vertexTriangles[next[T[i].v[j]]++] = i;
 }
 
 void Mesh::centerAndScaleToUnit () {
     Vec3f c;
-    for  (unsigned int i = 0; i < V.size (); i++)
-        c += V[i].p;
-    c /= V.size ();
-    float maxD = dist (V[0].p, c);
-    for (unsigned int i = 0; i < V.size (); i++){
-        float m = dist (V[i].p, c);
+    for  (unsigned int i = 0; i < positions.size (); i++)
+        c += positions[i];
+    c /= positions.size ();
+    float maxD = dist (positions[0], c);
+    for (unsigned int i = 0; i < positions.size (); i++){
+        float m = dist (positions[i], c);
         if (m > maxD)
             maxD = m;
     }
-    for  (unsigned int i = 0; i < V.size (); i++)
-        V[i].p = (V[i].p - c) / maxD;
+    for  (unsigned int i = 0; i < positions.size (); i++)
+        positions[i] = (positions[i] - c) / maxD;
+    updateTriangleRecords ();
+}
+
+void Mesh::updateTriangleRecords () {
+    PROFILE_ZONE ("Mesh::updateTriangleRecords");
+    records.resize (T.size ());
+    parallelFor (T.size (), 4096, [&] (unsigned int begin, unsigned int end) {
+        for (unsigned int i = begin; i < end; i++) {
+            // Same operations as Ray::intersect, so that both give the same results
+            TriangleRecord & r = records[i];
+            r.v0 = positions[T[i].v[0]];
+            r.e0 = positions[T[i].v[1]] - r.v0;
+            r.e1 = positions[T[i].v[2]] - r.v0;
+            r.n = cross (r.e0, r.e1);
+            r.n.normalize ();
+            float epsilon = 1e-6f;
+            r.epsilon = epsilon * epsilon * r.e0.squaredLength () * r.e1.squaredLength ();
+            for (unsigned int j = 0; j < 3; j++)
+                r.v[j] = T[i].v[j];
+        }
+    });
 }
@@ -20,55 +20,173 @@
 #include <cmath>
 #include <vector>
 #include "Vec3.h"
+#include "Aligned.h"
 
 /// A simple vertex class storing position and normal
 class Vertex {
 public:
     inline Vertex () {}
     inline Vertex (const Vec3f & p, const Vec3f & n) : p (p), n (n) {}
-    inline virtual ~Vertex () {}
     Vec3f p;
     Vec3f n;
 };
 
-/// A Triangle class expressed as a triplet of indices (over an external vertex list)
+/// A Triangle class expressed as a triplet of indices (over an external vertex list).
+/// Plain data: an array of triangles is an array of indices.
 class Triangle {
 public:
     inline Triangle () {
         v[0] = v[1] = v[2] = 0;
     }
-    inline Triangle (const Triangle & t) {
-        v[0] = t.v[0];
-        v[1] = t.v[1];
-        v[2] = t.v[2];
-    }
     inline Triangle (unsigned int v0, unsigned int v1, unsigned int v2) {
         v[0] = v0;
         v[1] = v1;
         v[2] = v2;
     }
-    inline virtual ~Triangle () {}
-    inline Triangle & operator= (const Triangle & t) {
-        v[0] = t.v[0];
-        v[1] = t.v[1];
-        v[2] = t.v[2];
-        return (*this);
+    /// True if the vertex of index i is a corner of the triangle
+    inline bool contains (unsigned int i) const {
+        return v[0] == i || v[1] == i || v[2] == i;
     }
     unsigned int v[3];
 };
 
+/// Array of one attribute per vertex, aligned on a cache line
+typedef std::vector<Vec3f, AlignedAllocator<Vec3f> > Vec3fArray;
+
+/// References to the position and normal of a vertex of a mesh
+template <class V3>
+class VertexRef {
+public:
+    inline VertexRef (V3 & p, V3 & n) : p (p), n (n) {}
+    inline operator Vertex () const { return Vertex (p, n); }
+    V3 & p;
+    V3 & n;
+};
+
+/// Array of vertices view over the position and normal arrays of a mesh,
+/// for the code written for an array of Vertex: V[i].p, V[i].n, V.size ()
+class VertexArray {
+public:
+    inline VertexArray (Vec3fArray & positions, Vec3fArray & normals) : positions (positions), normals (normals) {}
+    inline unsigned int size () const { return positions.size (); }
+    inline bool empty () const { return positions.empty (); }
+    inline void resize (unsigned int n) {
+        positions.resize (n);
+        normals.resize (n);
+    }
+    inline VertexRef<Vec3f> operator[] (unsigned int i) {
+        return VertexRef<Vec3f> (positions[i], normals[i]);
+    }
+    inline VertexRef<const Vec3f> operator[] (unsigned int i) const {
+        return VertexRef<const Vec3f> (positions[i], normals[i]);
+    }
+private:
+    Vec3fArray & positions;
+    Vec3fArray & normals;
+};
+
+/// Vertex index used for rays which do not start on a vertex of the mesh
+static const unsigned int NO_VERTEX = ~0u;
+
+/// Terms of the ray/triangle test which do not depend on the ray: first vertex,
+/// edges, unit normal and threshold on the squared determinant (see Ray::intersect).
+/// The vertex indices serve the self-hit policy. 64 bytes, one cache line per
+/// triangle in the scalar build; with the 16-byte Vec3f of VEC3_SIMD it takes 80
+/// bytes and spans two lines.
+class TriangleRecord {
+public:
+    Vec3f v0;
+    Vec3f e0;
+    Vec3f e1;
+    Vec3f n;
+    float epsilon;
+    unsigned int v[3];
+    inline bool contains (unsigned int i) const {
+        return v[0] == i || v[1] == i || v[2] == i;
+    }
+};
+
+#if !(defined(VEC3_SIMD) && defined(__SSE2__))
+static_assert (sizeof (TriangleRecord) == 64, "TriangleRecord must fill one cache line");
+#endif
+
 /// A Mesh class, storing a list of vertices and a list of triangles indexed over it.
 class Mesh {
 public:
-	std::vector<Vertex> V;
+    /// Vertex attributes, one contiguous array each (laid out as the GL buffers
+    /// and the sections of the cache files, sizeof (Vec3f) bytes per vertex)
+    Vec3fArray positions;
+    Vec3fArray normals;
+    /// Vertex view over positions and normals
+    VertexArray V;
 	std::vector<Triangle> T;
+    /// One record per triangle of T, for the intersection tests
+    std::vector<TriangleRecord, AlignedAllocator<TriangleRecord> > records;
+    /// Vertex to triangle adjacency in compressed rows: the triangles incident to
+    /// the vertex i are vertexTriangles[vertexTriangleOffsets[i] .. vertexTriangleOffsets[i + 1]),
+    /// in increasing order
+    std::vector<unsigned int> vertexTriangleOffsets;
+    std::vector<unsigned int> vertexTriangles;
+
+    /// Weights of the triangle normals in the vertex normals
+    enum NormalWeighting { UNIFORM_WEIGHTS, AREA_WEIGHTS, ANGLE_WEIGHTS };
+
+    inline Mesh () : V (positions, normals), glVertexBuffer (0), glColorBuffer (0), glIndexBuffer (0), glVertexArray (0),
+                     glColorMap (0), glColorFence (0) {}
+
+    /// The 3 T.size () vertex indices of the triangles, in a single array
+    inline const unsigned int * indices () const { return T.empty () ? 0 : T[0].v; }
+
+    /// The accessors of CompactMesh, for the code written for both storages
+    inline unsigned int numVertices () const { return positions.size (); }
+    inline const Vec3f & position (unsigned int i) const { return positions[i]; }
+    inline const Vec3f & normal (unsigned int i) const { return normals[i]; }
+    inline void triangle (unsigned int t, unsigned int v[3]) const {
+        v[0] = T[t].v[0];
+        v[1] = T[t].v[1];
+        v[2] = T[t].v[2];
+    }
 
-    /// Loads the mesh from a <file>.off
-	void loadOFF (const std::string & filename);
+    /// Loads the mesh from a <file>.off, returns false (with a message on
+    /// std::cerr) if the file cannot be read or is malformed. Polygons are
+    /// split into triangles.
+	bool loadOFF (const std::string & filename);
     
-    /// Compute smooth per-vertex normals
-    void recomputeNormals ();
+    /// Compute smooth per-vertex normals, the normalized weighted sum of the
+    /// normals of the incident triangles (a gather per vertex, in parallel)
+    void recomputeNormals (NormalWeighting weighting = UNIFORM_WEIGHTS);
 
     /// scale to the unit cube and center at original
     void centerAndScaleToUnit ();
+
+    /// Recomputes the triangle records from V and T, to call whenever positions
+    /// or triangles change (loadOFF and centerAndScaleToUnit already do)
+    void updateTriangleRecords ();
+
+    /// Rebuilds the vertex to triangle adjacency from T, to call whenever the
+    /// triangles change (loadOFF already does, recomputeNormals if the sizes differ)
+    void updateVertexTriangles ();
+
+    /// Uploads the positions, normals and indices to the GPU (needs a current GL context)
+    void initGLBuffers ();
+
+    /// Uploads one RGB color per vertex to the GPU color buffer
+    void updateGLColors (const std::vector<Vec3f> & colors);
+
+    /// Draws the mesh from its GPU buffers with a single glDrawElements
+    void drawGL ();
+
+private:
+    // V refers to the arrays of this mesh, and the GL objects are not shared
+    Mesh (const Mesh &);
+    Mesh & operator= (const Mesh &);
+
+    // OpenGL objects, created by initGLBuffers (see MeshGL.cpp)
+    unsigned int glVertexBuffer; // interleaved positions and normals
+    unsigned int glColorBuffer;
+    unsigned int glIndexBuffer;
+    unsigned int glVertexArray;  // 0 when vertex array objects are not supported
+    float * glColorMap;          // persistent mapping of the color buffer, if supported
+    void * glColorFence;         // sync object of the last draw reading glColorMap
+    void setupGLArrays ();
 };
@@ -0,0 +1,251 @@
+#include "MeshCache.h"
+#include "MeshReorder.h"
+#include "Profiler.h"
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace std;
+
+namespace {
+  const char MAGIC[8] = {'I', 'G', 'R', 'M', 'E', 'S', 'H', '\0'};
+  const unsigned int VERSION = 2;
+  const unsigned long long ALIGNMENT = 64;
+
+  // File layout: the header, then each non empty section at a 64-byte aligned offset
+  struct Header {
+    char magic[8];
+    unsigned int version;
+    unsigned int nodeSize;          // sizeof (BVHNode), to reject caches from other builds
+    unsigned int vectorSize;        // sizeof (Vec3f), 16 with VEC3_SIMD
+    unsigned int reordered;         // 1 if the mesh went through MeshReorder::reorder
+    unsigned long long sourceSize;  // size of the OFF file
+    long long sourceTime;           // modification time of the OFF file (ns)
+    unsigned int numVertices;
+    unsigned int numTriangles;
+    unsigned int numNodes;          // 0 when the BVH is not stored
+    unsigned int numNodeTriangles;
+    unsigned long long positions, normals, indices, nodes, nodeTriangles; // section offsets
+    unsigned long long fileSize;
+  };
+
+  inline unsigned long long alignUp (unsigned long long offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+
+  bool sourceStamp (const string & filename, unsigned long long & size, long long & time) {
+    struct stat st;
+    if (stat (filename.c_str (), &st) != 0)
+      return false;
+    size = st.st_size;
+    time = (long long) st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return true;
+  }
+
+  void layout (Header & h) {
+    unsigned long long offset = alignUp (sizeof (Header));
+    h.positions = offset;
+    offset = alignUp (offset + (unsigned long long) sizeof (Vec3f) * h.numVertices);
+    h.normals = offset;
+    offset = alignUp (offset + (unsigned long long) sizeof (Vec3f) * h.numVertices);
+    h.indices = offset;
+    offset = alignUp (offset + 3ULL * sizeof (unsigned int) * h.numTriangles);
+    h.nodes = offset;
+    offset = alignUp (offset + (unsigned long long) sizeof (BVHNode) * h.numNodes);
+    h.nodeTriangles = offset;
+    h.fileSize = offset + sizeof (unsigned int) * (unsigned long long) h.numNodeTriangles;
+  }
+  /// Read-only mapping of the cache of an OFF file, kept only if the cache is
+  /// up to date, of the given reordered flag, and its sections and triangle
+  /// indices are in range (data is null otherwise)
+  class MappedCache {
+   public:
+    MappedCache (const string & offFilename, bool reordered) : data (0), size (0) {
+      Header expected;
+      if (!sourceStamp (offFilename, expected.sourceSize, expected.sourceTime))
+        return;
+      int fd = open (MeshCache::cacheFilename (offFilename).c_str (), O_RDONLY);
+      if (fd < 0)
+        return;
+      struct stat st;
+      void * m = MAP_FAILED;
+      if (fstat (fd, &st) == 0 && (unsigned long long) st.st_size >= sizeof (Header))
+        m = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close (fd);
+      if (m == MAP_FAILED)
+        return;
+      memcpy (&h, m, sizeof (Header));
+      Header check = h;
+      layout (check);
+      bool valid = memcmp (h.magic, MAGIC, sizeof (MAGIC)) == 0
+        && h.version == VERSION && h.nodeSize == sizeof (BVHNode) && h.vectorSize == sizeof (Vec3f)
+        && h.sourceSize == expected.sourceSize && h.sourceTime == expected.sourceTime && h.reordered == (reordered ? 1u : 0u)
+        && h.numVertices > 0 && check.fileSize == h.fileSize && h.positions == check.positions
+        && h.normals == check.normals && h.indices == check.indices && h.nodes == check.nodes
+        && h.nodeTriangles == check.nodeTriangles && (unsigned long long) st.st_size == h.fileSize;
+      // The sections have the layout of the mesh arrays. The indices are checked
+      // before use: a damaged cache is rejected rather than read out of bounds.
+      const Triangle * triangles = (const Triangle *) ((const char *) m + h.indices);
+      for (unsigned int i = 0; valid && i < h.numTriangles; i++)
+        for (unsigned int j = 0; j < 3; j++)
+          valid = valid && triangles[i].v[j] < h.numVertices;
+      if (!valid) {
+        munmap (m, st.st_size);
+        return;
+      }
+      data = (const char *) m;
+      size = st.st_size;
+    }
+    ~MappedCache () {
+      if (data != 0)
+        munmap ((void *) data, size);
+    }
+
+    template <class T>
+    inline const T * section (unsigned long long offset) const { return (const T *) (data + offset); }
+
+    Header h;
+    const char * data;
+
+   private:
+    size_t size;
+    MappedCache (const MappedCache &);
+    MappedCache & operator= (const MappedCache &);
+  };
+}
+
+string MeshCache::cacheFilename (const string & offFilename) {
+  return offFilename + ".cache";
+}
+
+bool MeshCache::load (const string & offFilename, Mesh & mesh, BVH * bvh, bool reordered) {
+  PROFILE_ZONE ("MeshCache::load");
+  MappedCache cache (offFilename, reordered);
+  if (cache.data == 0)
+    return false;
+  const Header & h = cache.h;
+  if (bvh != 0) {
+    const BVHNode * nodes = cache.section<BVHNode> (h.nodes);
+    const unsigned int * nodeTriangles = cache.section<unsigned int> (h.nodeTriangles);
+    bvh->nodes.assign (nodes, nodes + h.numNodes);
+    bvh->triangles.assign (nodeTriangles, nodeTriangles + h.numNodeTriangles);
+    if (!bvh->valid (h.numTriangles)) {
+      bvh->nodes.clear ();
+      bvh->triangles.clear ();
+      return false;
+    }
+  }
+  const Vec3f * positions = cache.section<Vec3f> (h.positions);
+  const Vec3f * normals = cache.section<Vec3f> (h.normals);
+  const Triangle * triangles = cache.section<Triangle> (h.indices);
+  mesh.positions.assign (positions, positions + h.numVertices);
+  mesh.normals.assign (normals, normals + h.numVertices);
+  mesh.T.assign (triangles, triangles + h.numTriangles);
+  mesh.updateTriangleRecords ();
+  mesh.updateVertexTriangles ();
+  if (bvh != 0 && !bvh->nodes.empty ())
+    bvh->updateTriangleData (mesh);
+  return true;
+}
+
+bool MeshCache::save (const string & offFilename, const Mesh & mesh, const BVH * bvh, bool reordered) {
+  PROFILE_ZONE ("MeshCache::save");
+  Header h;
+  memset (&h, 0, sizeof (Header));
+  memcpy (h.magic, MAGIC, sizeof (MAGIC));
+  h.version = VERSION;
+  h.nodeSize = sizeof (BVHNode);
+  h.vectorSize = sizeof (Vec3f);
+  h.reordered = reordered ? 1 : 0;
+  if (!sourceStamp (offFilename, h.sourceSize, h.sourceTime))
+    return false;
+  h.numVertices = mesh.positions.size ();
+  h.numTriangles = mesh.T.size ();
+  h.numNodes = bvh != 0 ? bvh->nodes.size () : 0;
+  h.numNodeTriangles = bvh != 0 ? bvh->triangles.size () : 0;
+  layout (h);
+
+  vector<char> buffer (h.fileSize, 0);
+  memcpy (&buffer[0], &h, sizeof (Header));
+  memcpy (&buffer[h.positions], mesh.positions.data (), sizeof (Vec3f) * h.numVertices);
+  memcpy (&buffer[h.normals], mesh.normals.data (), sizeof (Vec3f) * h.numVertices);
+  if (h.numTriangles > 0)
+    memcpy (&buffer[h.indices], mesh.indices (), 3 * sizeof (unsigned int) * h.numTriangles);
+  if (h.numNodes > 0)
+    memcpy (&buffer[h.nodes], &bvh->nodes[0], sizeof (BVHNode) * h.numNodes);
+  if (h.numNodeTriangles > 0)
+    memcpy (&buffer[h.nodeTriangles], &bvh->triangles[0], sizeof (unsigned int) * h.numNodeTriangles);
+
+  // Written aside then renamed, so that a reader never sees a partial cache
+  string filename = cacheFilename (offFilename);
+  string tmpFilename = filename + ".tmp";
+  ofstream out (tmpFilename.c_str (), ios::binary);
+  if (!out)
+    return false;
+  out.write (&buffer[0], buffer.size ());
+  out.close ();
+  if (!out || rename (tmpFilename.c_str (), filename.c_str ()) != 0) {
+    remove (tmpFilename.c_str ());
+    return false;
+  }
+  return true;
+}
+
+bool MeshCache::loadOrBuild (const string & offFilename, Mesh & mesh, BVH & bvh, bool reorder) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now ();
+  if (load (offFilename, mesh, &bvh, reorder) && !bvh.nodes.empty ()) {
+    double seconds = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+    cerr << cacheFilename (offFilename) << ": " << mesh.V.size () << " vertices, " << mesh.T.size ()
+         << " triangles loaded in " << seconds * 1e3 << " ms" << endl;
+    return true;
+  }
+  if (!mesh.loadOFF (offFilename))
+    return false;
+  if (reorder)
+    MeshReorder::reorder (mesh);
+  bvh.build (mesh);
+  if (!save (offFilename, mesh, &bvh, reorder))
+    cerr << cacheFilename (offFilename) << ": cannot write the cache" << endl;
+  return true;
+}
+
+bool MeshCache::loadCompact (const string & offFilename, CompactMesh & compact, BVH & bvh, bool reorder) {
+  chrono::steady_clock::time_point start = chrono::steady_clock::now ();
+  bool encoded = false;
+  {
+    // The sections of an up to date cache are encoded straight from the mapping
+    MappedCache cache (offFilename, reorder);
+    if (cache.data != 0) {
+      const Header & h = cache.h;
+      compact.build (cache.section<Vec3f> (h.positions), cache.section<Vec3f> (h.normals), h.numVertices,
+                     cache.section<unsigned int> (h.indices), h.numTriangles);
+      double seconds = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+      cerr << cacheFilename (offFilename) << ": " << h.numVertices << " vertices, " << h.numTriangles
+           << " triangles encoded in " << seconds * 1e3 << " ms" << endl;
+      encoded = true;
+    }
+  }
+  if (!encoded) {
+    if (!reorder) {
+      if (!compact.loadOFF (offFilename))
+        return false;
+    } else {
+      // The reordering needs the float mesh: it is built once and cached
+      Mesh mesh;
+      if (!mesh.loadOFF (offFilename))
+        return false;
+      MeshReorder::reorder (mesh);
+      if (!save (offFilename, mesh, 0, true))
+        cerr << cacheFilename (offFilename) << ": cannot write the cache" << endl;
+      compact.build (mesh);
+    }
+  }
+  bvh.build (compact);
+  return true;
+}
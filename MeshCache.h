@@ -0,0 +1,44 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <string>
+#include "Mesh.h"
+#include "BVH.h"
+#include "CompactMesh.h"
+
+/// Binary cache of a mesh loaded from an OFF file, stored next to it as
+/// <file>.off.cache. It holds the positions and normals as computed by
+/// Mesh::loadOFF, the indices and optionally the BVH, in 64-byte aligned
+/// sections. Loading maps the file and copies each section once into the mesh
+/// and BVH arrays, then rebuilds the data derived from them (triangle records,
+/// vertex to triangle lists, BVH triangle packets). The header records the
+/// format version and the size and modification time of the OFF file, so
+/// that stale caches are ignored and rewritten, and whether the mesh was
+/// reordered (MeshReorder): a cache of the other layout is rewritten too.
+class MeshCache {
+ public:
+  static std::string cacheFilename (const std::string & offFilename);
+
+  /// Loads the cache of offFilename if it is up to date, returns false otherwise.
+  /// The BVH is loaded when bvh is not null and the cache contains one. The
+  /// cache must have been saved with the same reordered flag, and its indices
+  /// and hierarchy in range (BVH::valid).
+  static bool load (const std::string & offFilename, Mesh & mesh, BVH * bvh, bool reordered = false);
+
+  /// Writes the cache of offFilename (bvh may be null)
+  static bool save (const std::string & offFilename, const Mesh & mesh, const BVH * bvh, bool reordered = false);
+
+  /// Loads offFilename through its cache, building the BVH if needed and
+  /// refreshing the cache when it is missing or stale. With reorder, the mesh is
+  /// reordered for locality (MeshReorder::reorder) before the BVH is built.
+  static bool loadOrBuild (const std::string & offFilename, Mesh & mesh, BVH & bvh, bool reorder = false);
+
+  /// Loads offFilename into the compact storage and builds the BVH of the
+  /// compact mesh, without the float mesh: an up to date cache is encoded from
+  /// its mapped sections, otherwise the OFF file is streamed (CompactMesh::loadOFF).
+  /// With reorder and no such cache, the float mesh is loaded once to be
+  /// reordered, and cached for the next loads.
+  static bool loadCompact (const std::string & offFilename, CompactMesh & compact, BVH & bvh, bool reorder = false);
+};
+
+#endif
@@ -0,0 +1,133 @@
+// OpenGL side of the Mesh class: vertex, color and index buffers.
+// Kept apart from Mesh.cpp so that the mesh can be used without OpenGL.
+
+#define GL_GLEXT_PROTOTYPES
+#include "Mesh.h"
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <cstring>
+#include <string>
+
+using namespace std;
+
+namespace {
+  bool hasGLExtension (const char * name) {
+    const char * extensions = (const char *) glGetString (GL_EXTENSIONS);
+    if (extensions == 0)
+      return false;
+    size_t length = strlen (name);
+    for (const char * p = strstr (extensions, name); p != 0; p = strstr (p + length, name))
+      if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0'))
+        return true;
+    return false;
+  }
+}
+
+void Mesh::initGLBuffers () {
+    if (glVertexBuffer != 0) {
+        if (glColorMap != 0) {
+            glBindBuffer (GL_ARRAY_BUFFER, glColorBuffer);
+            glUnmapBuffer (GL_ARRAY_BUFFER);
+        }
+        if (glColorFence != 0)
+            glDeleteSync ((GLsync) glColorFence);
+        glDeleteBuffers (1, &glVertexBuffer);
+        glDeleteBuffers (1, &glColorBuffer);
+        glDeleteBuffers (1, &glIndexBuffer);
+        if (glVertexArray != 0)
+            glDeleteVertexArrays (1, &glVertexArray);
+        glVertexArray = 0;
+        glColorMap = 0;
+        glColorFence = 0;
+    }
+
+    // The attribute arrays are uploaded as they are: positions, then normals
+    GLsizeiptr attributeSize = positions.size () * sizeof (Vec3f);
+    glGenBuffers (1, &glVertexBuffer);
+    glBindBuffer (GL_ARRAY_BUFFER, glVertexBuffer);
+    glBufferData (GL_ARRAY_BUFFER, 2 * attributeSize, 0, GL_STATIC_DRAW);
+    glBufferSubData (GL_ARRAY_BUFFER, 0, attributeSize, positions.data ());
+    glBufferSubData (GL_ARRAY_BUFFER, attributeSize, attributeSize, normals.data ());
+
+    // Colors change with the lighting: the buffer is persistently mapped when the
+    // driver allows it, otherwise it is re-specified by updateGLColors
+    glGenBuffers (1, &glColorBuffer);
+    glBindBuffer (GL_ARRAY_BUFFER, glColorBuffer);
+    GLsizeiptr colorSize = positions.size () * sizeof (Vec3f);
+    if (hasGLExtension ("GL_ARB_buffer_storage")) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage (GL_ARRAY_BUFFER, colorSize, 0, flags);
+        glColorMap = (float *) glMapBufferRange (GL_ARRAY_BUFFER, 0, colorSize, flags);
+    }
+    if (glColorMap == 0)
+        glBufferData (GL_ARRAY_BUFFER, colorSize, 0, GL_STREAM_DRAW);
+
+    glGenBuffers (1, &glIndexBuffer);
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, glIndexBuffer);
+    glBufferData (GL_ELEMENT_ARRAY_BUFFER, 3 * T.size () * sizeof (unsigned int), indices (), GL_STATIC_DRAW);
+
+    if (hasGLExtension ("GL_ARB_vertex_array_object")) {
+        glGenVertexArrays (1, &glVertexArray);
+        glBindVertexArray (glVertexArray);
+        setupGLArrays ();
+        glBindVertexArray (0);
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Mesh::setupGLArrays () {
+    glBindBuffer (GL_ARRAY_BUFFER, glVertexBuffer);
+    glEnableClientState (GL_VERTEX_ARRAY);
+    glVertexPointer (3, GL_FLOAT, sizeof (Vec3f), (const GLvoid *) 0);
+    glEnableClientState (GL_NORMAL_ARRAY);
+    glNormalPointer (GL_FLOAT, sizeof (Vec3f), (const GLvoid *) (positions.size () * sizeof (Vec3f)));
+    glBindBuffer (GL_ARRAY_BUFFER, glColorBuffer);
+    glEnableClientState (GL_COLOR_ARRAY);
+    glColorPointer (3, GL_FLOAT, sizeof (Vec3f), (const GLvoid *) 0);
+    glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, glIndexBuffer);
+}
+
+void Mesh::updateGLColors (const vector<Vec3f> & colors) {
+    if (glColorBuffer == 0 || colors.size () != positions.size ())
+        return;
+    // The colors already are RGB floats, with the stride of Vec3f
+    GLsizeiptr colorSize = colors.size () * sizeof (Vec3f);
+    if (glColorMap != 0) {
+        // Wait for the previous draw to be done reading the mapped colors
+        if (glColorFence != 0) {
+            glClientWaitSync ((GLsync) glColorFence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+            glDeleteSync ((GLsync) glColorFence);
+            glColorFence = 0;
+        }
+        memcpy (glColorMap, colors.data (), colorSize);
+    } else {
+        glBindBuffer (GL_ARRAY_BUFFER, glColorBuffer);
+        glBufferData (GL_ARRAY_BUFFER, colorSize, colors.data (), GL_STREAM_DRAW);
+        glBindBuffer (GL_ARRAY_BUFFER, 0);
+    }
+}
+
+void Mesh::drawGL () {
+    if (glVertexBuffer == 0)
+        return;
+    if (glVertexArray != 0)
+        glBindVertexArray (glVertexArray);
+    else {
+        glPushClientAttrib (GL_CLIENT_VERTEX_ARRAY_BIT);
+        setupGLArrays ();
+    }
+    glDrawElements (GL_TRIANGLES, 3 * T.size (), GL_UNSIGNED_INT, (const GLvoid *) 0);
+    if (glVertexArray != 0)
+        glBindVertexArray (0);
+    else {
+        glPopClientAttrib ();
+        glBindBuffer (GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    glBindBuffer (GL_ARRAY_BUFFER, 0);
+    if (glColorMap != 0) {
+        if (glColorFence != 0)
+            glDeleteSync ((GLsync) glColorFence);
+        glColorFence = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
@@ -0,0 +1,216 @@
+#include "MeshReorder.h"
+#include "Profiler.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  const unsigned int NONE = ~0u;
+
+  /// Tipsify: emits the fans of the triangles around a vertex, then moves to the
+  /// vertex of the fan which will stay the longest in the cache while its
+  /// remaining triangles are emitted, or back to the last vertex with triangles
+  /// left (dead end). Returns the triangles in their new order.
+  vector<unsigned int> tipsify (Mesh & mesh, unsigned int cacheSize) {
+    if (mesh.vertexTriangleOffsets.size () != mesh.positions.size () + 1 || mesh.vertexTriangles.size () != 3 * mesh.T.size ())
+      mesh.updateVertexTriangles ();
+    unsigned int numVertices = mesh.positions.size ();
+    vector<unsigned int> live (numVertices);  // corners left to emit
+    for (unsigned int v = 0; v < numVertices; v++)
+      live[v] = mesh.vertexTriangleOffsets[v + 1] - mesh.vertexTriangleOffsets[v];
+    vector<unsigned int> stamp (numVertices, 0);  // time of entry in the cache
+    vector<bool> emitted (mesh.T.size (), false);
+    vector<unsigned int> order, deadEnds, candidates;
+    order.reserve (mesh.T.size ());
+    unsigned int time = cacheSize + 1;
+    unsigned int cursor = 0;
+
+    unsigned int fan = 0;
+    while (fan < numVertices && live[fan] == 0)
+      fan++;
+    while (fan < numVertices) {
+      candidates.clear ();
+      for (unsigned int k = mesh.vertexTriangleOffsets[fan]; k < mesh.vertexTriangleOffsets[fan + 1]; k++) {
+        unsigned int t = mesh.vertexTriangles[k];
+        if (emitted[t])
+          continue;
+        for (unsigned int j = 0; j < 3; j++) {
+          unsigned int v = mesh.T[t].v[j];
+          deadEnds.push_back (v);
+          candidates.push_back (v);
+          live[v]--;
+          if (time - stamp[v] > cacheSize)
+            stamp[v] = time++;
+        }
+        emitted[t] = true;
+        order.push_back (t);
+      }
+
+      // A candidate whose triangles all fit before it leaves the cache, the oldest first
+      unsigned int next = NONE;
+      int best = -1;
+      for (unsigned int i = 0; i < candidates.size (); i++) {
+        unsigned int v = candidates[i];
+        if (live[v] == 0)
+          continue;
+        int priority = time - stamp[v] + 2 * live[v] <= cacheSize ? time - stamp[v] : 0;
+        if (priority > best) {
+          best = priority;
+          next = v;
+        }
+      }
+      while (next == NONE && !deadEnds.empty ()) {
+        if (live[deadEnds.back ()] > 0)
+          next = deadEnds.back ();
+        deadEnds.pop_back ();
+      }
+      if (next == NONE) {
+        while (cursor < numVertices && live[cursor] == 0)
+          cursor++;
+        next = cursor;
+      }
+      fan = next;
+    }
+    return order;
+  }
+
+  /// Spreads the 10 lowest bits of x to every third bit
+  inline unsigned int spreadBits (unsigned int x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+  }
+
+  /// New index of each vertex
+  vector<unsigned int> vertexOrder (const Mesh & mesh, MeshReorder::VertexOrder order) {
+    unsigned int numVertices = mesh.positions.size ();
+    vector<unsigned int> newIndex (numVertices, NONE);
+    unsigned int next = 0;
+    if (order == MeshReorder::MORTON_ORDER) {
+      Vec3f low = mesh.positions[0], high = mesh.positions[0];
+      for (unsigned int v = 1; v < numVertices; v++)
+        for (unsigned int c = 0; c < 3; c++) {
+          low[c] = min (low[c], mesh.positions[v][c]);
+          high[c] = max (high[c], mesh.positions[v][c]);
+        }
+      vector<unsigned long long> keys (numVertices);  // Morton code above the vertex index
+      for (unsigned int v = 0; v < numVertices; v++) {
+        unsigned int code = 0;
+        for (unsigned int c = 0; c < 3; c++) {
+          float extent = high[c] - low[c];
+          unsigned int cell = extent > 0.0f ? (unsigned int) ((mesh.positions[v][c] - low[c]) / extent * 1023.0f) : 0;
+          code |= spreadBits (cell) << c;
+        }
+        keys[v] = (unsigned long long) code << 32 | v;
+      }
+      sort (keys.begin (), keys.end ());
+      for (unsigned int i = 0; i < numVertices; i++)
+        newIndex[keys[i] & 0xffffffff] = next++;
+    } else {
+      const unsigned int * indices = mesh.indices ();
+      for (unsigned int i = 0; i < 3 * mesh.T.size (); i++)
+        if (newIndex[indices[i]] == NONE)
+          newIndex[indices[i]] = next++;
+      // Unreferenced vertices last
+      for (unsigned int v = 0; v < numVertices; v++)
+        if (newIndex[v] == NONE)
+          newIndex[v] = next++;
+    }
+    return newIndex;
+  }
+
+  void applyTriangleOrder (Mesh & mesh, const vector<unsigned int> & order) {
+    vector<Triangle> newT (mesh.T.size ());
+    for (unsigned int i = 0; i < order.size (); i++)
+      newT[i] = mesh.T[order[i]];
+    mesh.T.swap (newT);
+  }
+
+  void applyVertexOrder (Mesh & mesh, const vector<unsigned int> & newIndex) {
+    Vec3fArray newPositions (mesh.positions.size ());
+    Vec3fArray newNormals (mesh.normals.size ());
+    for (unsigned int v = 0; v < newIndex.size (); v++) {
+      newPositions[newIndex[v]] = mesh.positions[v];
+      if (v < mesh.normals.size ())
+        newNormals[newIndex[v]] = mesh.normals[v];
+    }
+    mesh.positions.swap (newPositions);
+    mesh.normals.swap (newNormals);
+    for (unsigned int i = 0; i < mesh.T.size (); i++)
+      for (unsigned int j = 0; j < 3; j++)
+        mesh.T[i].v[j] = newIndex[mesh.T[i].v[j]];
+  }
+}
+
+void MeshReorder::reorder (Mesh & mesh, VertexOrder order, unsigned int cacheSize) {
+  PROFILE_ZONE ("MeshReorder::reorder");
+  if (mesh.positions.empty ())
+    return;
+  applyTriangleOrder (mesh, tipsify (mesh, cacheSize));
+  applyVertexOrder (mesh, vertexOrder (mesh, order));
+  mesh.updateVertexTriangles ();
+  mesh.updateTriangleRecords ();
+}
+
+void MeshReorder::reorderTriangles (Mesh & mesh, unsigned int cacheSize) {
+  PROFILE_ZONE ("MeshReorder::reorderTriangles");
+  if (mesh.positions.empty ())
+    return;
+  applyTriangleOrder (mesh, tipsify (mesh, cacheSize));
+  mesh.updateVertexTriangles ();
+  mesh.updateTriangleRecords ();
+}
+
+void MeshReorder::reorderVertices (Mesh & mesh, VertexOrder order) {
+  PROFILE_ZONE ("MeshReorder::reorderVertices");
+  if (mesh.positions.empty ())
+    return;
+  applyVertexOrder (mesh, vertexOrder (mesh, order));
+  mesh.updateVertexTriangles ();
+  mesh.updateTriangleRecords ();
+}
+
+float MeshReorder::averageCacheMissRatio (const Mesh & mesh, unsigned int cacheSize) {
+  if (mesh.T.empty ())
+    return 0.0f;
+  // A vertex is in the FIFO while fewer than cacheSize vertices entered after it
+  vector<unsigned int> stamp (mesh.positions.size (), 0);
+  unsigned int time = cacheSize + 1;
+  unsigned int misses = 0;
+  const unsigned int * indices = mesh.indices ();
+  for (unsigned int i = 0; i < 3 * mesh.T.size (); i++)
+    if (time - stamp[indices[i]] > cacheSize) {
+      stamp[indices[i]] = time++;
+      misses++;
+    }
+  return misses / float (mesh.T.size ());
+}
+
+float MeshReorder::vertexFetchMissRatio (const Mesh & mesh, unsigned int cacheBytes) {
+  if (mesh.T.empty ())
+    return 0.0f;
+  const unsigned int LINE = 64, WAYS = 8;
+  unsigned int numSets = max (1u, cacheBytes / (LINE * WAYS));
+  vector<unsigned long long> tags (numSets * WAYS, ~0ull);  // most recently used first
+  unsigned long long misses = 0;
+  const unsigned int * indices = mesh.indices ();
+  for (unsigned int i = 0; i < 3 * mesh.T.size (); i++) {
+    // The positions are aligned on a cache line, a vertex may straddle two
+    unsigned long long first = (unsigned long long) indices[i] * sizeof (Vec3f) / LINE;
+    unsigned long long last = ((unsigned long long) indices[i] * sizeof (Vec3f) + sizeof (Vec3f) - 1) / LINE;
+    for (unsigned long long line = first; line <= last; line++) {
+      unsigned long long * set = &tags[(line % numSets) * WAYS];
+      unsigned int way = find (set, set + WAYS, line) - set;
+      if (way == WAYS) {
+        misses++;
+        way = WAYS - 1;
+      }
+      copy_backward (set, set + way, set + way + 1);
+      set[0] = line;
+    }
+  }
+  return misses / float (mesh.T.size ());
+}
@@ -0,0 +1,127 @@
+#ifndef OFF_FILE_H
+#define OFF_FILE_H
+
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <charconv>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/// Cursor over the memory-mapped text of an OFF file
+class OFFParser {
+ public:
+  OFFParser (const char * begin, const char * end) : p (begin), end (end) {}
+
+  /// Skips blanks and '#' comments
+  inline void skipSpace () {
+    while (p < end) {
+      if (*p == '#') {
+        const char * eol = (const char *) memchr (p, '\n', end - p);
+        p = eol ? eol : end;
+      } else if (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        p++;
+      else
+        break;
+    }
+  }
+
+  /// Skips what remains of the current line (the end of the header: the rest
+  /// of the file is parsed token by token, whatever its layout in lines)
+  inline void skipLine () {
+    const char * eol = (const char *) memchr (p, '\n', end - p);
+    p = eol ? eol + 1 : end;
+  }
+
+  /// Skips the next token, false at the end of the text
+  inline bool skipToken () {
+    skipSpace ();
+    const char * begin = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r' && *p != '#')
+      p++;
+    return p > begin;
+  }
+
+  inline bool readWord (std::string & word) {
+    skipSpace ();
+    const char * begin = p;
+    skipToken ();
+    word.assign (begin, p);
+    return p > begin;
+  }
+
+  inline bool readFloat (float & f) {
+    skipSpace ();
+    if (p < end && *p == '+')
+      p++;
+    std::from_chars_result r = std::from_chars (p, end, f);
+    if (r.ec != std::errc ())
+      return false;
+    p = r.ptr;
+    return true;
+  }
+
+  inline bool readUInt (unsigned int & u) {
+    skipSpace ();
+    std::from_chars_result r = std::from_chars (p, end, u);
+    if (r.ec != std::errc ())
+      return false;
+    p = r.ptr;
+    return true;
+  }
+
+  /// Line number of the cursor, for error messages
+  unsigned int line (const char * begin) const {
+    return 1 + std::count (begin, p, '\n');
+  }
+
+  const char * p;
+  const char * end;
+};
+
+/// Read-only memory mapping of a whole file
+class MappedFile {
+ public:
+  MappedFile (const std::string & filename) : data (0), size (0) {
+    int fd = open (filename.c_str (), O_RDONLY);
+    if (fd < 0)
+      return;
+    struct stat st;
+    if (fstat (fd, &st) == 0 && st.st_size > 0) {
+      void * m = mmap (0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (m != MAP_FAILED) {
+        data = (const char *) m;
+        size = st.st_size;
+        madvise (m, size, MADV_SEQUENTIAL);
+      }
+    }
+    close (fd);
+  }
+  ~MappedFile () {
+    if (data != 0)
+      munmap ((void *) data, size);
+  }
+
+  /// Streaming parsers release the text they have read every RELEASE_BYTES
+  static const size_t RELEASE_BYTES = 16 << 20;
+
+  /// Drops the pages before p from the resident memory, when streaming a file
+  /// larger than the memory (they are read again if accessed)
+  void release (const char * p) const {
+    long pageSize = sysconf (_SC_PAGESIZE);
+    size_t length = (p - data) / pageSize * pageSize;
+    if (length > 0)
+      madvise ((void *) data, length, MADV_DONTNEED);
+  }
+
+  const char * data;
+  size_t size;
+
+ private:
+  MappedFile (const MappedFile &);
+  MappedFile & operator= (const MappedFile &);
+};
+
+#endif
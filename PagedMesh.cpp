@@ -0,0 +1,810 @@
+#include "PagedMesh.h"
+#include "OFFFile.h"
+#include "Parallel.h"
+#include "Profiler.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <chrono>
+#include <queue>
+#include <algorithm>
+#include <type_traits>
+
+using namespace std;
+
+namespace {
+  const char MAGIC[8] = {'I', 'G', 'R', 'P', 'A', 'G', 'E', 'S'};
+  const unsigned int VERSION = 1;
+  const unsigned long long ALIGNMENT = 64;
+  /// Bound of the prefetch queue: older requests are dropped first
+  const unsigned int MAX_QUEUED = 16;
+
+  // File layout: the header, the pages at 64-byte aligned offsets, then the page table
+  struct Header {
+    char magic[8];
+    unsigned int version;
+    unsigned int vectorSize;        // sizeof (Vec3f), 16 with VEC3_SIMD
+    unsigned int nodeSize;          // sizeof (BVHNode)
+    unsigned int trianglesPerPage;
+    unsigned int numVertices;
+    unsigned int numTriangles;
+    unsigned int numPages;
+    unsigned int reserved;
+    unsigned long long pageTable;   // offset of the PageInfo array
+  };
+
+  // Sections of a page, relative to its offset
+  struct PageLayout {
+    unsigned long long positions, normals, vertexIds, triangles, nodes, nodeTriangles, size;
+  };
+
+  inline unsigned long long alignUp (unsigned long long offset) {
+    return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+
+  PageLayout layout (const PagedMesh::PageInfo & info) {
+    PageLayout l;
+    l.positions = 0;
+    l.normals = alignUp (l.positions + (unsigned long long) sizeof (Vec3f) * info.numVertices);
+    l.vertexIds = alignUp (l.normals + (unsigned long long) sizeof (Vec3f) * info.numVertices);
+    l.triangles = alignUp (l.vertexIds + (unsigned long long) sizeof (unsigned int) * info.numVertices);
+    l.nodes = alignUp (l.triangles + (unsigned long long) sizeof (Triangle) * info.numTriangles);
+    l.nodeTriangles = alignUp (l.nodes + (unsigned long long) sizeof (BVHNode) * info.numNodes);
+    l.size = l.nodeTriangles + (unsigned long long) sizeof (unsigned int) * info.numTriangles;
+    return l;
+  }
+
+
+  /// Temporary array in a memory-mapped file, zero-initialized and deleted on
+  /// destruction: the system writes it back to the disk under memory pressure
+  template <class T>
+  class MappedArray {
+   public:
+    MappedArray (const string & directory, size_t n) : data (0), bytes (max ((size_t) 1, n * sizeof (T))) {
+      string name = directory + "/.paged.XXXXXX";
+      int fd = mkstemp (&name[0]);
+      if (fd < 0)
+        return;
+      unlink (name.c_str ());
+      if (ftruncate (fd, bytes) == 0) {
+        void * m = mmap (0, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (m != MAP_FAILED)
+          data = (T *) m;
+      }
+      ::close (fd);
+    }
+    ~MappedArray () {
+      if (data != 0)
+        munmap (data, bytes);
+    }
+    T * data;
+   private:
+    size_t bytes;
+    MappedArray (const MappedArray &);
+    MappedArray & operator= (const MappedArray &);
+  };
+
+  /// Triangle with the Morton code of its centroid above its index, the sort key
+  struct SortedTriangle {
+    unsigned long long key;
+    unsigned int v[3];
+    inline bool operator< (const SortedTriangle & t) const { return key < t.key; }
+  };
+
+  /// Spreads the 10 lowest bits of x to every third bit
+  inline unsigned int spreadBits (unsigned int x) {
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x << 8)) & 0x0300f00f;
+    x = (x | (x << 4)) & 0x030c30c3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+  }
+
+  /// Morton code of a point of [-1, 1]^3
+  inline unsigned int mortonCode (const Vec3f & p) {
+    unsigned int code = 0;
+    for (unsigned int c = 0; c < 3; c++) {
+      float u = max (0.0f, min (1.0f, (p[c] + 1.0f) * 0.5f));
+      code |= spreadBits ((unsigned int) (u * 1023.0f)) << c;
+    }
+    return code;
+  }
+
+  bool readFully (int fd, void * buffer, size_t size, unsigned long long offset) {
+    char * p = (char *) buffer;
+    while (size > 0) {
+      ssize_t n = pread (fd, p, size, offset);
+      if (n <= 0)
+        return false;
+      p += n;
+      size -= n;
+      offset += n;
+    }
+    return true;
+  }
+
+  bool writeFully (int fd, const void * buffer, size_t size) {
+    const char * p = (const char *) buffer;
+    while (size > 0) {
+      ssize_t n = write (fd, p, size);
+      if (n <= 0)
+        return false;
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  /// Sorted runs of triangles in a temporary file, merged back in order
+  class RunMerger {
+   public:
+    RunMerger (int fd, const vector<unsigned long long> & runEnds, size_t memoryBudget) : fd (fd) {
+      unsigned int numRuns = runEnds.size ();
+      bufferSize = max ((size_t) 1024, memoryBudget / sizeof (SortedTriangle) / max (1u, numRuns));
+      runs.resize (numRuns);
+      for (unsigned int r = 0; r < numRuns; r++) {
+        runs[r].next = r > 0 ? runEnds[r - 1] : 0;
+        runs[r].end = runEnds[r];
+        if (fill (r))
+          heap.push (make_pair (runs[r].buffer[0].key, r));
+      }
+    }
+
+    /// Next triangle in order, false at the end
+    bool next (SortedTriangle & t) {
+      if (heap.empty ())
+        return false;
+      unsigned int r = heap.top ().second;
+      heap.pop ();
+      Run & run = runs[r];
+      t = run.buffer[run.position++];
+      if (run.position < run.buffer.size () || fill (r))
+        heap.push (make_pair (run.buffer[run.position].key, r));
+      return true;
+    }
+
+   private:
+    struct Run {
+      unsigned long long next, end;   // bytes of the run left in the file
+      vector<SortedTriangle> buffer;
+      unsigned int position;
+    };
+
+    bool fill (unsigned int r) {
+      Run & run = runs[r];
+      size_t count = min ((unsigned long long) bufferSize, (run.end - run.next) / sizeof (SortedTriangle));
+      run.buffer.resize (count);
+      run.position = 0;
+      if (count == 0 || !readFully (fd, &run.buffer[0], count * sizeof (SortedTriangle), run.next))
+        return false;
+      run.next += count * sizeof (SortedTriangle);
+      return true;
+    }
+
+    int fd;
+    size_t bufferSize;
+    vector<Run> runs;
+    priority_queue<pair<unsigned long long, unsigned int>, vector<pair<unsigned long long, unsigned int> >,
+                   greater<pair<unsigned long long, unsigned int> > > heap;
+  };
+
+  /// Writes one page made of the triangles, returns its entry of the page table
+  bool writePage (int out, unsigned long long offset, const vector<SortedTriangle> & triangles,
+                  const Vec3f * positions, const Vec3f * normals, PagedMesh::PageInfo & info) {
+    memset (&info, 0, sizeof (info));
+    vector<unsigned int> vertexIds;
+    vertexIds.reserve (3 * triangles.size ());
+    for (unsigned int i = 0; i < triangles.size (); i++)
+      vertexIds.insert (vertexIds.end (), triangles[i].v, triangles[i].v + 3);
+    sort (vertexIds.begin (), vertexIds.end ());
+    vertexIds.erase (unique (vertexIds.begin (), vertexIds.end ()), vertexIds.end ());
+
+    Mesh mesh;
+    mesh.positions.resize (vertexIds.size ());
+    mesh.normals.resize (vertexIds.size ());
+    for (unsigned int i = 0; i < vertexIds.size (); i++) {
+      mesh.positions[i] = positions[vertexIds[i]];
+      mesh.normals[i] = normals[vertexIds[i]];
+    }
+    mesh.T.resize (triangles.size ());
+    for (unsigned int i = 0; i < triangles.size (); i++)
+      for (unsigned int j = 0; j < 3; j++)
+        mesh.T[i].v[j] = lower_bound (vertexIds.begin (), vertexIds.end (), triangles[i].v[j]) - vertexIds.begin ();
+    mesh.updateTriangleRecords ();
+    BVH bvh;
+    bvh.build (mesh);
+
+    info.offset = offset;
+    info.numVertices = vertexIds.size ();
+    info.numTriangles = triangles.size ();
+    info.numNodes = bvh.nodes.size ();
+    for (unsigned int k = 0; k < 3; k++) {
+      info.bmin[k] = bvh.nodes[0].bmin[k];
+      info.bmax[k] = bvh.nodes[0].bmax[k];
+    }
+    PageLayout l = layout (info);
+    vector<char> buffer (l.size, 0);
+    memcpy (&buffer[l.positions], mesh.positions.data (), sizeof (Vec3f) * info.numVertices);
+    memcpy (&buffer[l.normals], mesh.normals.data (), sizeof (Vec3f) * info.numVertices);
+    memcpy (&buffer[l.vertexIds], vertexIds.data (), sizeof (unsigned int) * info.numVertices);
+    memcpy (&buffer[l.triangles], mesh.indices (), sizeof (Triangle) * info.numTriangles);
+    memcpy (&buffer[l.nodes], &bvh.nodes[0], sizeof (BVHNode) * info.numNodes);
+    memcpy (&buffer[l.nodeTriangles], &bvh.triangles[0], sizeof (unsigned int) * info.numTriangles);
+    buffer.resize (alignUp (l.size), 0);
+    return writeFully (out, &buffer[0], buffer.size ());
+  }
+
+  /// Slab test of a ray against a box (min then max corner), as BVH::anyHit
+  inline float hitBox (const float * box, const float o[3], const float inv[3], float tMax) {
+    float tmin = 0.0f;
+    for (int k = 0; k < 3; k++) {
+      float t0 = (box[k] - o[k]) * inv[k];
+      float t1 = (box[3 + k] - o[k]) * inv[k];
+      if (t0 > t1) swap (t0, t1);
+      tmin = max (tmin, t0);
+      tMax = min (tMax, t1);
+    }
+    return tmin <= tMax ? tmin : -1.0f;
+  }
+}
+
+static_assert (std::is_trivially_copyable<PagedMesh::PageInfo>::value, "PageInfo is written as raw memory");
+
+unsigned int PagedMesh::Page::localVertex (unsigned int v) const {
+  vector<unsigned int>::const_iterator i = lower_bound (vertexIds.begin (), vertexIds.end (), v);
+  return i != vertexIds.end () && *i == v ? i - vertexIds.begin () : NO_VERTEX;
+}
+
+size_t PagedMesh::pageBytes (const PageInfo & info) {
+  return sizeof (Page) + 2 * sizeof (Vec3f) * info.numVertices + sizeof (unsigned int) * info.numVertices
+    + sizeof (Triangle) * info.numTriangles + sizeof (BVHNode) * info.numNodes
+    + sizeof (unsigned int) * info.numTriangles
+    + (info.numTriangles + TriangleSoA::PACKET_SIZE) * (13 * sizeof (float) + 3 * sizeof (unsigned int));
+}
+
+/// Keeps the page alive until the pointer returned by acquire is released, then
+/// evicts the pages beyond the budget
+class PagedMesh::Release {
+ public:
+  Release (PagedMesh * owner, const shared_ptr<const Page> & page) : owner (owner), page (page) {}
+  void operator() (const Page *) {
+    page.reset ();
+    lock_guard<std::mutex> lock (owner->mutex);
+    owner->evict ();
+  }
+ private:
+  PagedMesh * owner;
+  shared_ptr<const Page> page;
+};
+
+PagedMesh::PagedMesh () : fd (-1), budget (0), vertexCount (0), triangleCount (0), leafBase (0),
+                          resident (0), quit (false) {
+  memset (&counters, 0, sizeof (counters));
+}
+
+PagedMesh::~PagedMesh () {
+  close ();
+}
+
+bool PagedMesh::convert (const string & offFilename, const string & pagedFilename,
+                         size_t memoryBudget, unsigned int trianglesPerPage) {
+  PROFILE_ZONE ("PagedMesh::convert");
+  chrono::steady_clock::time_point start = chrono::steady_clock::now ();
+  MappedFile file (offFilename);
+  if (file.data == 0) {
+    cerr << offFilename << ": cannot read the file" << endl;
+    return false;
+  }
+  OFFParser parser (file.data, file.data + file.size);
+  string offString;
+  unsigned int sizeV, sizeT, sizeE;
+  if (!parser.readWord (offString) || offString != "OFF"
+      || !parser.readUInt (sizeV) || !parser.readUInt (sizeT) || !parser.readUInt (sizeE)) {
+    cerr << offFilename << ": not an OFF file (bad header)" << endl;
+    return false;
+  }
+  if (sizeV == 0) {
+    cerr << offFilename << ": the mesh has no vertex" << endl;
+    return false;
+  }
+  parser.skipLine ();
+  string directory = pagedFilename.find ('/') == string::npos ? "." : pagedFilename.substr (0, pagedFilename.rfind ('/'));
+  MappedArray<Vec3f> positions (directory, sizeV), normals (directory, sizeV);
+  if (positions.data == 0 || normals.data == 0) {
+    cerr << directory << ": cannot create the temporary files" << endl;
+    return false;
+  }
+
+  // Vertices, centered and scaled to the unit sphere with the operations of
+  // Mesh::centerAndScaleToUnit, so that both give the same positions
+  Vec3f c;
+  const char * released = file.data;
+  for (unsigned int i = 0; i < sizeV; i++) {
+    Vec3f & p = positions.data[i];
+    if (!parser.readFloat (p[0]) || !parser.readFloat (p[1]) || !parser.readFloat (p[2])) {
+      cerr << offFilename << ":" << parser.line (file.data) << ": bad vertex " << i << endl;
+      return false;
+    }
+    c += p;
+    if (parser.p - released > (ptrdiff_t) MappedFile::RELEASE_BYTES)
+      file.release (released = parser.p);
+  }
+  c /= sizeV;
+  float maxD = dist (positions.data[0], c);
+  for (unsigned int i = 0; i < sizeV; i++)
+    maxD = max (maxD, dist (positions.data[i], c));
+  for (unsigned int i = 0; i < sizeV; i++)
+    positions.data[i] = (positions.data[i] - c) / maxD;
+
+  // Faces, split in fans as Mesh::loadOFF does. The unit triangle normals are
+  // summed per vertex in the order of the triangles, as Mesh::recomputeNormals.
+  // The triangles are sorted in runs of the size of the budget.
+  string runName = directory + "/.paged.XXXXXX";
+  int runs = mkstemp (&runName[0]);
+  if (runs < 0) {
+    cerr << directory << ": cannot create the temporary files" << endl;
+    return false;
+  }
+  unlink (runName.c_str ());
+  vector<SortedTriangle> run;
+  size_t runSize = max ((size_t) 1024, memoryBudget / sizeof (SortedTriangle));
+  run.reserve (min (runSize, (size_t) sizeT));
+  vector<unsigned long long> runEnds;
+  unsigned long long runBytes = 0;
+  unsigned int numTriangles = 0;
+  ostringstream error;
+  for (unsigned int i = 0; i < sizeT && error.tellp () == 0; i++) {
+    unsigned int n, v0, v1, v2;
+    if (!parser.readUInt (n) || n < 3 || !parser.readUInt (v0) || !parser.readUInt (v2)) {
+      error << offFilename << ":" << parser.line (file.data) << ": bad face " << i;
+      break;
+    }
+    for (unsigned int j = 2; j < n; j++) {
+      v1 = v2;
+      if (!parser.readUInt (v2)) {
+        error << offFilename << ":" << parser.line (file.data) << ": bad face " << i;
+        break;
+      }
+      if (v0 >= sizeV || v1 >= sizeV || v2 >= sizeV) {
+        error << offFilename << ":" << parser.line (file.data) << ": face " << i
+              << " has a vertex index out of range";
+        break;
+      }
+      const Vec3f & p0 = positions.data[v0], & p1 = positions.data[v1], & p2 = positions.data[v2];
+      Vec3f n = cross (p1 - p0, p2 - p0);
+      n.normalize ();
+      normals.data[v0] += n;
+      normals.data[v1] += n;
+      normals.data[v2] += n;
+      SortedTriangle t;
+      t.key = (unsigned long long) mortonCode ((p0 + p1 + p2) / 3.0f) << 32 | numTriangles++;
+      t.v[0] = v0;
+      t.v[1] = v1;
+      t.v[2] = v2;
+      run.push_back (t);
+      if (run.size () == runSize) {
+        sort (run.begin (), run.end ());
+        if (!writeFully (runs, &run[0], run.size () * sizeof (SortedTriangle)))
+          error << runName << ": cannot write the temporary file";
+        runEnds.push_back (runBytes += run.size () * sizeof (SortedTriangle));
+        run.clear ();
+      }
+    }
+    if (parser.p - released > (ptrdiff_t) MappedFile::RELEASE_BYTES)
+      file.release (released = parser.p);
+  }
+  if (error.tellp () == 0 && numTriangles == 0)
+    error << offFilename << ": the mesh has no triangle";
+  if (error.tellp () != 0) {
+    cerr << error.str () << endl;
+    ::close (runs);
+    return false;
+  }
+  for (unsigned int i = 0; i < sizeV; i++)
+    normals.data[i].normalize ();
+  sort (run.begin (), run.end ());
+  if (!runEnds.empty () && !run.empty ()) {
+    if (!writeFully (runs, &run[0], run.size () * sizeof (SortedTriangle))) {
+      cerr << runName << ": cannot write the temporary file" << endl;
+      ::close (runs);
+      return false;
+    }
+    runEnds.push_back (runBytes += run.size () * sizeof (SortedTriangle));
+    vector<SortedTriangle> ().swap (run);
+  }
+
+  // Pages of consecutive triangles in Morton order, written aside then renamed
+  // so that a reader never sees a partial file
+  string tmpFilename = pagedFilename + ".tmp";
+  int out = ::open (tmpFilename.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out < 0) {
+    cerr << tmpFilename << ": cannot write the file" << endl;
+    ::close (runs);
+    return false;
+  }
+  Header h;
+  memset (&h, 0, sizeof (Header));
+  bool ok = writeFully (out, &h, sizeof (Header));
+  unsigned long long offset = alignUp (sizeof (Header));
+  vector<char> padding (offset - sizeof (Header), 0);
+  ok = ok && writeFully (out, padding.data (), padding.size ());
+  RunMerger merger (runs, runEnds, memoryBudget);
+  vector<PageInfo> table;
+  vector<SortedTriangle> page;
+  page.reserve (trianglesPerPage);
+  unsigned int next = 0;
+  SortedTriangle t;
+  while (ok) {
+    bool more = runEnds.empty () ? next < run.size () : merger.next (t);
+    if (more && runEnds.empty ())
+      t = run[next++];
+    if (more)
+      page.push_back (t);
+    if (page.size () == trianglesPerPage || (!more && !page.empty ())) {
+      PageInfo info;
+      ok = writePage (out, offset, page, positions.data, normals.data, info);
+      offset += alignUp (layout (info).size);
+      table.push_back (info);
+      page.clear ();
+    }
+    if (!more)
+      break;
+  }
+  ::close (runs);
+  memcpy (h.magic, MAGIC, sizeof (MAGIC));
+  h.version = VERSION;
+  h.vectorSize = sizeof (Vec3f);
+  h.nodeSize = sizeof (BVHNode);
+  h.trianglesPerPage = trianglesPerPage;
+  h.numVertices = sizeV;
+  h.numTriangles = numTriangles;
+  h.numPages = table.size ();
+  h.pageTable = offset;
+  ok = ok && writeFully (out, &table[0], sizeof (PageInfo) * table.size ())
+    && pwrite (out, &h, sizeof (Header), 0) == (ssize_t) sizeof (Header);
+  ok = ::close (out) == 0 && ok;
+  if (!ok || rename (tmpFilename.c_str (), pagedFilename.c_str ()) != 0) {
+    cerr << pagedFilename << ": cannot write the file" << endl;
+    remove (tmpFilename.c_str ());
+    return false;
+  }
+  double seconds = chrono::duration<double> (chrono::steady_clock::now () - start).count ();
+  cerr << pagedFilename << ": " << sizeV << " vertices, " << numTriangles << " triangles in "
+       << table.size () << " pages, converted in " << seconds * 1e3 << " ms ("
+       << max ((size_t) 1, runEnds.size ()) << " sorted runs)" << endl;
+  return true;
+}
+
+bool PagedMesh::open (const string & filename, size_t memoryBudget) {
+  close ();
+  fd = ::open (filename.c_str (), O_RDONLY);
+  if (fd < 0)
+    return false;
+  Header h;
+  if (!readFully (fd, &h, sizeof (Header), 0) || memcmp (h.magic, MAGIC, sizeof (MAGIC)) != 0
+      || h.version != VERSION || h.vectorSize != sizeof (Vec3f) || h.nodeSize != sizeof (BVHNode)
+      || h.numPages == 0) {
+    close ();
+    return false;
+  }
+  struct stat st;
+  unsigned long long fileSize = fstat (fd, &st) == 0 ? st.st_size : 0;
+  if (h.pageTable > fileSize || sizeof (PageInfo) * (unsigned long long) h.numPages > fileSize - h.pageTable) {
+    close ();
+    return false;
+  }
+  pages.resize (h.numPages);
+  if (!readFully (fd, &pages[0], sizeof (PageInfo) * h.numPages, h.pageTable)) {
+    close ();
+    return false;
+  }
+  // The pages are read at the offsets of the table: they must lie within the file
+  for (unsigned int p = 0; p < pages.size (); p++) {
+    unsigned long long size = layout (pages[p]).size;
+    if (pages[p].offset > fileSize || size > fileSize - pages[p].offset) {
+      cerr << filename << ": page " << p << " lies past the end of the file" << endl;
+      close ();
+      return false;
+    }
+  }
+  size_t largest = 0;
+  for (unsigned int p = 0; p < pages.size (); p++)
+    largest = max (largest, pageBytes (pages[p]));
+  if (memoryBudget < largest) {
+    cerr << filename << ": a budget of " << memoryBudget << " bytes cannot hold the largest page ("
+         << largest << " bytes)" << endl;
+    close ();
+    return false;
+  }
+  budget = memoryBudget;
+  vertexCount = h.numVertices;
+  triangleCount = h.numTriangles;
+
+  // The leaves past the last page repeat its box, the rays skip them
+  leafBase = 1;
+  while (leafBase < pages.size ())
+    leafBase *= 2;
+  treeBoxes.resize (12 * leafBase);
+  for (unsigned int i = 0; i < leafBase; i++) {
+    const PageInfo & info = pages[min (i, (unsigned int) pages.size () - 1)];
+    float * box = &treeBoxes[6 * (leafBase + i)];
+    copy (info.bmin, info.bmin + 3, box);
+    copy (info.bmax, info.bmax + 3, box + 3);
+  }
+  for (unsigned int i = leafBase - 1; i > 0; i--)
+    for (unsigned int k = 0; k < 3; k++) {
+      treeBoxes[6 * i + k] = min (treeBoxes[12 * i + k], treeBoxes[12 * i + 6 + k]);
+      treeBoxes[6 * i + 3 + k] = max (treeBoxes[12 * i + 3 + k], treeBoxes[12 * i + 9 + k]);
+    }
+
+  entries.assign (pages.size (), Entry ());
+  resident = 0;
+  memset (&counters, 0, sizeof (counters));
+  quit = false;
+  loader = thread (&PagedMesh::loaderLoop, this);
+  return true;
+}
+
+void PagedMesh::close () {
+  {
+    lock_guard<std::mutex> lock (mutex);
+    quit = true;
+    queue.clear ();
+  }
+  wake.notify_all ();
+  if (loader.joinable ())
+    loader.join ();
+  entries.clear ();
+  lru.clear ();
+  pages.clear ();
+  treeBoxes.clear ();
+  resident = 0;
+  if (fd >= 0)
+    ::close (fd);
+  fd = -1;
+}
+
+shared_ptr<const PagedMesh::Page> PagedMesh::acquire (unsigned int p) {
+  shared_ptr<const Page> page = load (p, true);
+  if (!page)
+    return page;
+  return shared_ptr<const Page> (page.get (), Release (this, page));
+}
+
+shared_ptr<const PagedMesh::Page> PagedMesh::load (unsigned int p, bool countRequest) {
+  unique_lock<std::mutex> lock (mutex);
+  if (countRequest)
+    counters.requests++;
+  Entry & e = entries[p];
+  while (e.loading)
+    loaded.wait (lock);
+  if (e.page) {
+    if (countRequest)
+      counters.hits++;
+    lru.splice (lru.begin (), lru, e.lru);
+    return e.page;
+  }
+  // A prefetch only fills the free part of the budget: evicting a page for it
+  // could drop a page about to be used
+  if (!countRequest && resident + pageBytes (pages[p]) > budget)
+    return shared_ptr<const Page> ();
+  e.loading = true;
+  lock.unlock ();
+  shared_ptr<const Page> page = readPage (p);
+  lock.lock ();
+  e.loading = false;
+  if (page) {
+    e.page = page;
+    lru.push_front (p);
+    e.lru = lru.begin ();
+    resident += page->bytes;
+    counters.loads++;
+    // The new page is held by this call, it is not evicted
+    evict ();
+    counters.peakResidentBytes = max (counters.peakResidentBytes, resident);
+  } else
+    cerr << "page " << p << ": cannot read the page" << endl;
+  loaded.notify_all ();
+  return page;
+}
+
+shared_ptr<PagedMesh::Page> PagedMesh::readPage (unsigned int p) const {
+  PROFILE_ZONE ("PagedMesh::readPage");
+  const PageInfo & info = pages[p];
+  PageLayout l = layout (info);
+  vector<char> buffer (l.size);
+  if (!readFully (fd, &buffer[0], l.size, info.offset))
+    return shared_ptr<Page> ();
+  shared_ptr<Page> page = make_shared<Page> ();
+  const Vec3f * positions = (const Vec3f *) &buffer[l.positions];
+  const Vec3f * normals = (const Vec3f *) &buffer[l.normals];
+  const unsigned int * vertexIds = (const unsigned int *) &buffer[l.vertexIds];
+  const Triangle * triangles = (const Triangle *) &buffer[l.triangles];
+  const BVHNode * nodes = (const BVHNode *) &buffer[l.nodes];
+  const unsigned int * nodeTriangles = (const unsigned int *) &buffer[l.nodeTriangles];
+  // The contents are checked before use: a damaged page is rejected rather
+  // than read out of bounds
+  bool valid = true;
+  for (unsigned int i = 0; valid && i < info.numVertices; i++)
+    valid = vertexIds[i] < vertexCount && (i == 0 || vertexIds[i - 1] < vertexIds[i]);
+  for (unsigned int i = 0; valid && i < info.numTriangles; i++)
+    for (unsigned int j = 0; j < 3; j++)
+      valid = valid && triangles[i].v[j] < info.numVertices;
+  page->bvh.nodes.assign (nodes, nodes + info.numNodes);
+  page->bvh.triangles.assign (nodeTriangles, nodeTriangles + info.numTriangles);
+  if (!valid || !page->bvh.valid (info.numTriangles))
+    return shared_ptr<Page> ();
+  page->mesh.positions.assign (positions, positions + info.numVertices);
+  page->mesh.normals.assign (normals, normals + info.numVertices);
+  page->vertexIds.assign (vertexIds, vertexIds + info.numVertices);
+  page->mesh.T.assign (triangles, triangles + info.numTriangles);
+  page->mesh.updateTriangleRecords ();
+  page->bvh.updateTriangleData (page->mesh);
+  // The packets of the BVH replace the records
+  decltype (page->mesh.records) ().swap (page->mesh.records);
+  page->bytes = pageBytes (info);
+  return page;
+}
+
+void PagedMesh::evict () {
+  // Least recently used first, skipping the pages in use
+  for (list<unsigned int>::iterator i = lru.end (); resident > budget && i != lru.begin (); ) {
+    --i;
+    Entry & e = entries[*i];
+    if (e.page.use_count () > 1)
+      continue;
+    resident -= e.page->bytes;
+    e.page.reset ();
+    counters.evictions++;
+    i = lru.erase (i);
+  }
+}
+
+void PagedMesh::prefetch (unsigned int p) {
+  {
+    lock_guard<std::mutex> lock (mutex);
+    if (entries[p].page || entries[p].loading || find (queue.begin (), queue.end (), p) != queue.end ())
+      return;
+    if (queue.size () == MAX_QUEUED)
+      queue.pop_front ();
+    queue.push_back (p);
+  }
+  wake.notify_one ();
+}
+
+void PagedMesh::loaderLoop () {
+  unique_lock<std::mutex> lock (mutex);
+  while (true) {
+    wake.wait (lock, [this] () { return quit || !queue.empty (); });
+    if (quit)
+      return;
+    unsigned int p = queue.front ();
+    queue.pop_front ();
+    lock.unlock ();
+    load (p, false);
+    lock.lock ();
+  }
+}
+
+void PagedMesh::pagesAlongRay (const Ray & ray, float tMax, vector<unsigned int> & result) const {
+  float o[3], inv[3];
+  for (int k = 0; k < 3; k++) {
+    o[k] = ray.origin[k];
+    inv[k] = 1.0f / (ray.direction[k] != 0.0f ? ray.direction[k] : 1e-30f);
+  }
+  static thread_local vector<pair<float, unsigned int> > hits;
+  hits.clear ();
+  unsigned int stack[64];
+  unsigned int stackSize = 0;
+  stack[stackSize++] = 1;
+  while (stackSize > 0) {
+    unsigned int node = stack[--stackSize];
+    float t = hitBox (&treeBoxes[6 * node], o, inv, tMax);
+    if (t < 0.0f)
+      continue;
+    if (node >= leafBase) {
+      if (node - leafBase < pages.size ())
+        hits.push_back (make_pair (t, node - leafBase));
+    } else {
+      stack[stackSize++] = 2 * node + 1;
+      stack[stackSize++] = 2 * node;
+    }
+  }
+  sort (hits.begin (), hits.end ());
+  result.resize (hits.size ());
+  for (unsigned int i = 0; i < hits.size (); i++)
+    result[i] = hits[i].second;
+}
+
+int PagedMesh::anyHit (Ray & ray, unsigned int source, float tMax) {
+  static thread_local vector<unsigned int> order;
+  pagesAlongRay (ray, tMax, order);
+  for (unsigned int i = 1; i <= PREFETCH_DEPTH && i < order.size (); i++)
+    prefetch (order[i]);
+  for (unsigned int i = 0; i < order.size (); i++) {
+    if (i > 0 && i + PREFETCH_DEPTH < order.size ())
+      prefetch (order[i + PREFETCH_DEPTH]);
+    shared_ptr<const Page> page = acquire (order[i]);
+    if (page && page->bvh.anyHit (ray, page->mesh, page->localVertex (source), tMax))
+      return 1;
+  }
+  return 0;
+}
+
+void PagedMesh::anyHit (const vector<Ray> & rays, const vector<unsigned int> & sources, float tMax,
+                        vector<int> & hits) {
+  PROFILE_ZONE ("PagedMesh::anyHit batch");
+  // Rays crossing each page, as a CSR
+  vector<vector<unsigned int> > rayPages (rays.size ());
+  parallelFor (rays.size (), 256, [&] (unsigned int begin, unsigned int end) {
+    for (unsigned int r = begin; r < end; r++)
+      pagesAlongRay (rays[r], tMax, rayPages[r]);
+  });
+  vector<unsigned int> pageStart (pages.size () + 1, 0);
+  for (unsigned int r = 0; r < rays.size (); r++)
+    for (unsigned int i = 0; i < rayPages[r].size (); i++)
+      pageStart[rayPages[r][i] + 1]++;
+  for (unsigned int p = 0; p < pages.size (); p++)
+    pageStart[p + 1] += pageStart[p];
+  vector<unsigned int> pageRays (pageStart.back ());
+  vector<unsigned int> fill (pageStart.begin (), pageStart.end () - 1);
+  for (unsigned int r = 0; r < rays.size (); r++)
+    for (unsigned int i = 0; i < rayPages[r].size (); i++)
+      pageRays[fill[rayPages[r][i]]++] = r;
+  decltype (rayPages) ().swap (rayPages);
+
+  hits.assign (rays.size (), 0);
+  vector<unsigned int> order;
+  for (unsigned int p = 0; p < pages.size (); p++)
+    if (pageStart[p + 1] > pageStart[p])
+      order.push_back (p);
+  for (unsigned int i = 0; i < order.size (); i++) {
+    for (unsigned int k = 1; k <= PREFETCH_DEPTH && i + k < order.size (); k++)
+      prefetch (order[i + k]);
+    shared_ptr<const Page> page = acquire (order[i]);
+    if (!page)
+      continue;
+    const unsigned int * pending = &pageRays[pageStart[order[i]]];
+    parallelFor (pageStart[order[i] + 1] - pageStart[order[i]], 64, [&] (unsigned int begin, unsigned int end) {
+      for (unsigned int j = begin; j < end; j++) {
+        unsigned int r = pending[j];
+        if (hits[r])
+          continue;
+        Ray ray = rays[r];
+        hits[r] = page->bvh.anyHit (ray, page->mesh, page->localVertex (sources[r]), tMax);
+      }
+    });
+  }
+}
+
+void PagedMesh::shade (BRDFKernel kernel, const Vec3<float> & light, const Vec3<float> & camera,
+                       const function<void (const Page &, const float *)> & f) {
+  vector<float> colors;
+  for (unsigned int p = 0; p < pages.size (); p++) {
+    for (unsigned int k = 1; k <= PREFETCH_DEPTH && p + k < pages.size (); k++)
+      prefetch (p + k);
+    shared_ptr<const Page> page = acquire (p);
+    if (!page)
+      continue;
+    const Mesh & mesh = page->mesh;
+    colors.resize (mesh.positions.size ());
+    parallelFor (mesh.positions.size (), 256, [&] (unsigned int begin, unsigned int end) {
+      kernel (&mesh.positions[0], &mesh.normals[0], light, camera, begin, end, &colors[0]);
+    });
+    f (*page, &colors[0]);
+  }
+}
+
+size_t PagedMesh::residentBytes () {
+  lock_guard<std::mutex> lock (mutex);
+  return resident;
+}
+
+PagedMesh::Stats PagedMesh::stats () {
+  lock_guard<std::mutex> lock (mutex);
+  return counters;
+}
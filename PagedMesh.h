@@ -0,0 +1,166 @@
+#ifndef PAGED_MESH_H
+#define PAGED_MESH_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "BVH.h"
+#include "Ray.h"
+#include "Shading.h"
+
+/// Out-of-core mesh, for models larger than the memory. PagedMesh::convert
+/// streams an OFF file into a paged file: the triangles are sorted along a
+/// Morton curve of their centroids and cut into pages of trianglesPerPage
+/// triangles, each with its own vertices (positions and smooth normals, as
+/// Mesh::loadOFF computes them), their global indices and a BVH. At run
+/// time, the pages are read on demand into an LRU cache whose size is capped
+/// by a memory budget; the pages in use by a query are kept until released.
+/// Queries prefetch the pages they will visit next on a loader thread.
+class PagedMesh {
+ public:
+  static const unsigned int TRIANGLES_PER_PAGE = 16384;
+  /// Pages a query requests ahead of the one it works on
+  static const unsigned int PREFETCH_DEPTH = 2;
+
+  /// A page: a mesh of its own, with local vertex indices
+  class Page {
+   public:
+    Mesh mesh;
+    BVH bvh;
+    std::vector<unsigned int> vertexIds;  // global index of each vertex, increasing
+    size_t bytes;                         // resident size, counted in the budget
+
+    /// Local index of the global vertex v, NO_VERTEX if the page does not contain it
+    unsigned int localVertex (unsigned int v) const;
+  };
+
+  /// Entry of the page table, always resident
+  struct PageInfo {
+    unsigned long long offset;
+    unsigned int numVertices;
+    unsigned int numTriangles;
+    unsigned int numNodes;
+    float bmin[3];
+    float bmax[3];
+  };
+
+  /// Counters since open
+  struct Stats {
+    unsigned long long requests;     // acquire calls
+    unsigned long long hits;         // acquire calls served from the cache
+    unsigned long long loads;        // pages read from the file
+    unsigned long long evictions;
+    size_t peakResidentBytes;
+  };
+
+  PagedMesh ();
+  ~PagedMesh ();
+
+  /// Converts offFilename into pagedFilename, using about memoryBudget bytes for
+  /// the sort of the triangles (the vertex attributes are accumulated in
+  /// temporary memory-mapped files next to pagedFilename). Returns false (with
+  /// a message on std::cerr) if the OFF file cannot be read or is malformed.
+  static bool convert (const std::string & offFilename, const std::string & pagedFilename,
+                       size_t memoryBudget, unsigned int trianglesPerPage = TRIANGLES_PER_PAGE);
+
+  /// Opens a paged file, with a cache of at most memoryBudget bytes of pages.
+  /// Returns false if the file cannot be read, or if the budget cannot hold
+  /// its largest page (with a message on std::cerr).
+  bool open (const std::string & filename, size_t memoryBudget);
+
+  /// Drops the cache and closes the file (waits for the pending prefetches; the
+  /// pages acquired must have been released)
+  void close ();
+
+  inline unsigned int numVertices () const { return vertexCount; }
+  inline unsigned int numTriangles () const { return triangleCount; }
+  inline unsigned int numPages () const { return pages.size (); }
+  inline const PageInfo & pageInfo (unsigned int p) const { return pages[p]; }
+
+  /// Resident size of the page p, counted in the budget
+  static size_t pageBytes (const PageInfo & info);
+
+  /// The page p, read from the file if it is not resident. It stays in memory
+  /// while the returned pointer lives: the pages in use may exceed the budget
+  /// (the queries hold one page per thread), the least recently used pages are
+  /// evicted as soon as they are released.
+  std::shared_ptr<const Page> acquire (unsigned int p);
+
+  /// Requests the page p from the loader thread, if it is not resident (the
+  /// loader skips it if it does not fit in the free part of the budget)
+  void prefetch (unsigned int p);
+
+  /// Shadow query: returns 1 as soon as the ray hits a triangle closer than
+  /// tMax, skipping the triangles incident to the global vertex source. The
+  /// pages whose boxes the ray crosses are visited front to back.
+  int anyHit (Ray & ray, unsigned int source, float tMax = 1e30f);
+
+  /// Shadow queries of a batch of rays, page by page rather than ray by ray:
+  /// each page is read at most once, so the batch does not thrash the cache
+  /// when the pages a ray crosses do not fit in the budget. hits[i] is set as
+  /// anyHit (rays[i], sources[i], tMax) would return.
+  void anyHit (const std::vector<Ray> & rays, const std::vector<unsigned int> & sources, float tMax,
+               std::vector<int> & hits);
+
+  /// Evaluates the BRDF kernel at the vertices of every page, in the order of
+  /// the pages, and calls f with each page and its results. A vertex shared by
+  /// several pages is evaluated in each of them.
+  void shade (BRDFKernel kernel, const Vec3<float> & light, const Vec3<float> & camera,
+              const std::function<void (const Page &, const float *)> & f);
+
+  size_t residentBytes ();
+  Stats stats ();
+
+ private:
+  struct Entry {
+    Entry () : loading (false) {}
+    std::shared_ptr<const Page> page;
+    bool loading;
+    std::list<unsigned int>::iterator lru;
+  };
+
+  /// Deleter of the pointers returned by acquire
+  class Release;
+
+  PagedMesh (const PagedMesh &);
+  PagedMesh & operator= (const PagedMesh &);
+
+  std::shared_ptr<const Page> load (unsigned int p, bool countRequest);
+  std::shared_ptr<Page> readPage (unsigned int p) const;
+  void evict ();
+  void loaderLoop ();
+  /// Pages whose boxes the ray crosses before tMax, by increasing entry distance
+  void pagesAlongRay (const Ray & ray, float tMax, std::vector<unsigned int> & result) const;
+
+  int fd;
+  size_t budget;
+  unsigned int vertexCount;
+  unsigned int triangleCount;
+  std::vector<PageInfo> pages;
+  /// Boxes of the implicit binary tree over the pages (node i has the children
+  /// 2 i and 2 i + 1, the page p is the node leafBase + p)
+  std::vector<float> treeBoxes;
+  unsigned int leafBase;
+
+  std::mutex mutex;
+  std::condition_variable loaded;
+  std::vector<Entry> entries;
+  std::list<unsigned int> lru;    // resident pages, most recently used first
+  size_t resident;
+  Stats counters;
+
+  std::thread loader;
+  std::condition_variable wake;
+  std::deque<unsigned int> queue;
+  bool quit;
+};
+
+#endif
@@ -0,0 +1,82 @@
+#include "Parallel.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  // Set while a thread is running chunks of a loop, to detect nested loops
+  thread_local bool insideLoop = false;
+}
+
+ThreadPool & ThreadPool::instance () {
+  static ThreadPool pool (max (1u, thread::hardware_concurrency ()));
+  return pool;
+}
+
+ThreadPool::ThreadPool (unsigned int numThreads)
+  : job (0), jobSize (0), jobGrain (1), next (0), active (0), generation (0), quit (false) {
+  for (unsigned int i = 1; i < numThreads; i++)
+    workers.push_back (thread (&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool () {
+  {
+    lock_guard<std::mutex> lock (mutex);
+    quit = true;
+  }
+  wake.notify_all ();
+  for (unsigned int i = 0; i < workers.size (); i++)
+    workers[i].join ();
+}
+
+void ThreadPool::runChunks () {
+  insideLoop = true;
+  unsigned int begin;
+  while ((begin = next.fetch_add (jobGrain)) < jobSize)
+    (*job) (begin, min (begin + jobGrain, jobSize));
+  insideLoop = false;
+}
+
+void ThreadPool::workerLoop () {
+  unsigned long seen = 0;
+  while (true) {
+    {
+      unique_lock<std::mutex> lock (mutex);
+      wake.wait (lock, [&] { return quit || generation != seen; });
+      if (quit)
+        return;
+      seen = generation;
+    }
+    runChunks ();
+    {
+      lock_guard<std::mutex> lock (mutex);
+      if (--active == 0)
+        done.notify_one ();
+    }
+  }
+}
+
+void ThreadPool::parallelFor (unsigned int n, unsigned int grain, const RangeFunction & f) {
+  if (n == 0)
+    return;
+  grain = max (1u, grain);
+  if (insideLoop || workers.empty () || n <= grain) {
+    f (0, n);
+    return;
+  }
+  lock_guard<std::mutex> jobLock (jobMutex);
+  {
+    lock_guard<std::mutex> lock (mutex);
+    job = &f;
+    jobSize = n;
+    jobGrain = grain;
+    next = 0;
+    active = workers.size ();
+    generation++;
+  }
+  wake.notify_all ();
+  runChunks ();
+  unique_lock<std::mutex> lock (mutex);
+  done.wait (lock, [&] { return active == 0; });
+  job = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+
+/// Persistent pool of worker threads running chunked parallel loops.
+/// Chunks are handed out dynamically through an atomic counter, so that
+/// threads finishing early take the remaining work of slower ones.
+class ThreadPool {
+ public:
+  /// Range body, called with [begin, end) sub-ranges of the loop
+  typedef std::function<void (unsigned int, unsigned int)> RangeFunction;
+
+  /// Pool shared by the whole application, one thread per core
+  static ThreadPool & instance ();
+
+  /// Number of threads working on a loop, including the calling thread
+  inline unsigned int size () const { return workers.size () + 1; }
+
+  /// Runs f over [0, n) in chunks of 'grain' indices and returns when all are done.
+  /// Calls nested in a running loop are executed serially by the calling thread.
+  void parallelFor (unsigned int n, unsigned int grain, const RangeFunction & f);
+
+ private:
+  ThreadPool (unsigned int numThreads);
+  ~ThreadPool ();
+  void workerLoop ();
+  void runChunks ();
+
+  std::vector<std::thread> workers;
+  std::mutex jobMutex;   // serializes the loops submitted from different threads
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::condition_variable done;
+  const RangeFunction * job;
+  unsigned int jobSize;
+  unsigned int jobGrain;
+  std::atomic<unsigned int> next;
+  unsigned int active;
+  unsigned long generation;
+  bool quit;
+};
+
+/// Shortcut for ThreadPool::instance ().parallelFor (n, grain, f)
+inline void parallelFor (unsigned int n, unsigned int grain, const ThreadPool::RangeFunction & f) {
+  ThreadPool::instance ().parallelFor (n, grain, f);
+}
+
+#endif
@@ -0,0 +1,124 @@
+#include "Profiler.h"
+#include <chrono>
+#include <mutex>
+#include <map>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  // Zones of one thread: 'head' only grows, the last RING_SIZE events are kept
+  class ThreadBuffer {
+  public:
+    ThreadBuffer (unsigned int id) : id (id), head (0), events (Profiler::RING_SIZE) {}
+    unsigned int id;
+    atomic<unsigned long long> head;
+    vector<ProfileEvent> events;
+  };
+
+  // Buffers live until the end of the program, threads of the pool never exit
+  mutex buffersMutex;
+  vector<ThreadBuffer *> buffers;
+  thread_local ThreadBuffer * threadBuffer = 0;
+
+  const chrono::steady_clock::time_point epoch = chrono::steady_clock::now ();
+
+  ThreadBuffer * currentBuffer () {
+    if (threadBuffer == 0) {
+      lock_guard<mutex> lock (buffersMutex);
+      threadBuffer = new ThreadBuffer (buffers.size ());
+      buffers.push_back (threadBuffer);
+    }
+    return threadBuffer;
+  }
+
+  // Calls f on every recorded event
+  template <typename Function>
+  void forEachEvent (Function f) {
+    lock_guard<mutex> lock (buffersMutex);
+    for (unsigned int b = 0; b < buffers.size (); b++) {
+      unsigned long long head = buffers[b]->head.load (memory_order_acquire);
+      unsigned long long first = head > Profiler::RING_SIZE ? head - Profiler::RING_SIZE : 0;
+      for (unsigned long long i = first; i < head; i++)
+        f (buffers[b]->id, buffers[b]->events[i % Profiler::RING_SIZE]);
+    }
+  }
+
+  bool slowerPhase (const ProfilePhase & a, const ProfilePhase & b) {
+    return a.milliseconds > b.milliseconds;
+  }
+
+  // Orders zone names by content, the same literal may have several addresses
+  class NameLess {
+  public:
+    bool operator() (const char * a, const char * b) const { return strcmp (a, b) < 0; }
+  };
+}
+
+atomic<bool> Profiler::enabled (false);
+
+void Profiler::setEnabled (bool e) {
+  enabled.store (e, memory_order_relaxed);
+}
+
+unsigned long long Profiler::now () {
+  // Never 0, which ProfileZone uses for "not recording"
+  return chrono::duration_cast<chrono::nanoseconds> (chrono::steady_clock::now () - epoch).count () + 1;
+}
+
+void Profiler::record (const char * name, unsigned long long start, unsigned long long end) {
+  ThreadBuffer * buffer = currentBuffer ();
+  unsigned long long head = buffer->head.load (memory_order_relaxed);
+  ProfileEvent & event = buffer->events[head % RING_SIZE];
+  event.name = name;
+  event.start = start;
+  event.end = end;
+  buffer->head.store (head + 1, memory_order_release);
+}
+
+vector<ProfilePhase> Profiler::phases (unsigned long long since) {
+  map<const char *, ProfilePhase, NameLess> byName;
+  forEachEvent ([&] (unsigned int, const ProfileEvent & e) {
+    if (e.end <= since)
+      return;
+    ProfilePhase & phase = byName[e.name];
+    phase.name = e.name;
+    phase.milliseconds += (e.end - e.start) * 1e-6;
+    phase.count++;
+  });
+  vector<ProfilePhase> result;
+  for (map<const char *, ProfilePhase, NameLess>::const_iterator it = byName.begin (); it != byName.end (); ++it)
+    result.push_back (it->second);
+  sort (result.begin (), result.end (), slowerPhase);
+  return result;
+}
+
+void Profiler::printPhases (ostream & out, unsigned long long since, unsigned int numFrames) {
+  vector<ProfilePhase> p = phases (since);
+  numFrames = max (1u, numFrames);
+  char line[128];
+  out << "Profile (ms per frame over " << numFrames << " frames):" << endl;
+  for (unsigned int i = 0; i < p.size (); i++) {
+    snprintf (line, sizeof (line), "  %-20s %9.3f  (%u zones)", p[i].name,
+              p[i].milliseconds / numFrames, p[i].count / numFrames);
+    out << line << endl;
+  }
+}
+
+bool Profiler::writeChromeTrace (const string & filename) {
+  FILE * file = fopen (filename.c_str (), "w");
+  if (file == 0)
+    return false;
+  fprintf (file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  bool first = true;
+  forEachEvent ([&] (unsigned int thread, const ProfileEvent & e) {
+    // Complete events, times in microseconds
+    fprintf (file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+             first ? "" : ",\n", e.name, thread, e.start * 1e-3, (e.end - e.start) * 1e-3);
+    first = false;
+  });
+  fprintf (file, "\n]}\n");
+  return fclose (file) == 0;
+}
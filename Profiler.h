@@ -0,0 +1,75 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <iostream>
+
+/// A timed zone of code, times in nanoseconds since the start of the program
+class ProfileEvent {
+ public:
+  const char * name;
+  unsigned long long start;
+  unsigned long long end;
+};
+
+/// Total time spent in the zones of one name
+class ProfilePhase {
+ public:
+  const char * name;
+  double milliseconds;
+  unsigned int count;
+};
+
+/// Low-overhead zone timer. Every thread records its zones in its own ring
+/// buffer, keeping the last RING_SIZE ones, so recording never locks.
+/// Buffers are read when no zone is being recorded, e.g. between two frames.
+class Profiler {
+ public:
+  static const unsigned int RING_SIZE = 1 << 16;
+
+  /// Nothing is recorded while disabled, zones then only cost a test
+  static inline bool isEnabled () { return enabled.load (std::memory_order_relaxed); }
+  static void setEnabled (bool e);
+
+  /// Nanoseconds since the start of the program
+  static unsigned long long now ();
+
+  /// Records a zone in the ring buffer of the calling thread
+  static void record (const char * name, unsigned long long start, unsigned long long end);
+
+  /// Time per zone name among the zones ended after 'since', slowest first.
+  /// Zones run by several threads add up their times.
+  static std::vector<ProfilePhase> phases (unsigned long long since);
+
+  /// Prints phases (since), divided by numFrames
+  static void printPhases (std::ostream & out, unsigned long long since, unsigned int numFrames);
+
+  /// Writes the recorded zones in the Chrome trace_event format (chrome://tracing, Perfetto)
+  static bool writeChromeTrace (const std::string & filename);
+
+ private:
+  static std::atomic<bool> enabled;
+};
+
+/// Records the time from its construction to its destruction
+class ProfileZone {
+ public:
+  inline ProfileZone (const char * name) : name (name), start (Profiler::isEnabled () ? Profiler::now () : 0) {}
+  inline ~ProfileZone () {
+    if (start != 0 && Profiler::isEnabled ())
+      Profiler::record (name, start, Profiler::now ());
+  }
+
+ private:
+  const char * name;
+  unsigned long long start;
+};
+
+#define PROFILE_CONCAT2(a, b) a ## b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2 (a, b)
+/// Times the rest of the enclosing scope, 'name' must be a string literal
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT (profileZone, __LINE__) (name)
+
+#endif
@@ -7,6 +7,11 @@ Ray::Ray(float vx, float vy, float vz, float lx, float ly, float lz){
 };
 
 int Ray::intersect(Vec3<float> v0, Vec3<float> v1, Vec3<float> v2){
+  float t;
+  return intersect(v0, v1, v2, t);
+};
+
+int Ray::intersect(Vec3<float> v0, Vec3<float> v1, Vec3<float> v2, float & t){
 
   // Implemantation found on the internet
   // At this site here: http://geomalgorithms.com/a06-_intersect-2.html
@@ -59,8 +64,10 @@ int Ray::intersect(Vec3<float> v0, Vec3<float> v1, Vec3<float> v2){
   float a = dot(e0, q);
   // std::cerr << "Value of a: " << a << std::endl;
 
-  float epsilon = 0.1f;
-  if ((dot(norm, direction) >= 0) || (std::abs(a) < epsilon))
+  // a scales with the area of the triangle, so the threshold is relative to the
+  // edges: an absolute one rejected every small triangle of the dense meshes
+  float epsilon = 1e-6f;
+  if ((dot(norm, direction) >= 0) || (a * a < epsilon * epsilon * e0.squaredLength() * e1.squaredLength()))
     return 0;
 
   Vec3<float> s = (origin - v0)/a;
@@ -73,7 +80,7 @@ int Ray::intersect(Vec3<float> v0, Vec3<float> v1, Vec3<float> v2){
   if ((b0<0) || (b1<0) || (b2<0))
     return 0;
 
-  float t = dot(e1, r);
+  t = dot(e1, r);
 
   if (t>= 0)
     return 1;
@@ -82,3 +89,56 @@ int Ray::intersect(Vec3<float> v0, Vec3<float> v1, Vec3<float> v2){
 
   // End of implementation of the amgorithm proposed by teacher
 };
+
+int Ray::intersect(const TriangleRecord & tri) const{
+  float t;
+  return intersect(tri, t);
+};
+
+int Ray::intersect(const TriangleRecord & tri, float & t) const{
+  Vec3<float> q = cross(direction, tri.e1);
+  float a = dot(tri.e0, q);
+  if ((dot(tri.n, direction) >= 0) || (a * a < tri.epsilon))
+    return 0;
+
+  Vec3<float> s = (origin - tri.v0)/a;
+  Vec3<float> r = cross(s, tri.e0);
+
+  float b0 = dot(s, q);
+  float b1 = dot(r, direction);
+  float b2 = 1 - b0 - b1;
+
+  if ((b0<0) || (b1<0) || (b2<0))
+    return 0;
+
+  t = dot(tri.e1, r);
+
+  if (t>= 0)
+    return 1;
+
+  return 0;
+};
+
+
+int Ray::intersectSphere(const Vec3<float> & center, float radius){
+
+  Vec3<float> oc = center - origin;
+  float oc2 = dot(oc, oc);
+  float r2 = radius * radius;
+
+  // The origin is inside the sphere
+  if (oc2 <= r2)
+    return 1;
+
+  // The sphere is behind the origin
+  float tca = dot(oc, direction);
+  if (tca < 0)
+    return 0;
+
+  // Squared distance between the center and the ray
+  float d2 = oc2 - tca * tca;
+  if (d2 > r2)
+    return 0;
+
+  return 1;
+};
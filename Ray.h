@@ -12,6 +12,13 @@ class Ray {
 
   Ray(float vx, float vy, float vz, float lx, float ly, float lz);
   int intersect(Vec3<float> v0, Vec3<float> v1, Vec3<float> v2);
+  // Same test, also returning the distance to the hit point in t
+  int intersect(Vec3<float> v0, Vec3<float> v1, Vec3<float> v2, float & t);
+  // Same test on the precomputed terms of a triangle, without reading its vertices
+  int intersect(const TriangleRecord & tri, float & t) const;
+  int intersect(const TriangleRecord & tri) const;
+  // Returns 1 if the ray (a half-line) crosses the sphere
+  int intersectSphere(const Vec3<float> & center, float radius);
 };
 
 #endif
@@ -0,0 +1,53 @@
+#include "RayStats.h"
+#include <vector>
+#include <mutex>
+#include <cstdio>
+
+using namespace std;
+
+namespace {
+  // Counters live until the end of the program, threads of the pool never exit
+  mutex statsMutex;
+  vector<RayStats *> threadStats;
+  thread_local RayStats * localStats = 0;
+}
+
+RayStats & RayStats::operator+= (const RayStats & s) {
+  rays += s.rays;
+  hits += s.hits;
+  triangleTests += s.triangleTests;
+  nodesVisited += s.nodesVisited;
+  earlyOuts += s.earlyOuts;
+  return *this;
+}
+
+RayStats & RayStats::local () {
+  if (localStats == 0) {
+    lock_guard<mutex> lock (statsMutex);
+    localStats = new RayStats;
+    threadStats.push_back (localStats);
+  }
+  return *localStats;
+}
+
+RayStats RayStats::collect () {
+  RayStats total;
+  lock_guard<mutex> lock (statsMutex);
+  for (unsigned int i = 0; i < threadStats.size (); i++) {
+    total += *threadStats[i];
+    threadStats[i]->clear ();
+  }
+  return total;
+}
+
+void RayStats::print (ostream & out, unsigned int numFrames) const {
+  char line[256];
+  double n = numFrames > 0 ? numFrames : 1;
+  double r = rays > 0 ? rays : 1;
+  snprintf (line, sizeof (line),
+            "Rays: %.0f, hits: %.0f, triangle tests: %.0f, nodes: %.0f, early-outs: %.0f"
+            " (per ray: %.1f tests, %.1f nodes)",
+            rays / n, hits / n, triangleTests / n, nodesVisited / n, earlyOuts / n,
+            triangleTests / r, nodesVisited / r);
+  out << line << endl;
+}
@@ -0,0 +1,49 @@
+#ifndef RAYSTATS_H
+#define RAYSTATS_H
+
+#include <iostream>
+
+/// Work done by ray queries. Every thread counts in its own instance,
+/// collect () merges and resets them between two frames.
+class RayStats {
+ public:
+  unsigned long long rays;           // queries cast (any hit or closest hit)
+  unsigned long long hits;           // queries which found a triangle
+  unsigned long long triangleTests;  // ray/triangle intersection tests
+  unsigned long long nodesVisited;   // bounding volumes tested by the acceleration structures
+  unsigned long long earlyOuts;      // bounding volumes missed, culling their subtree
+
+  RayStats () { clear (); }
+  void clear () { rays = hits = triangleTests = nodesVisited = earlyOuts = 0; }
+  RayStats & operator+= (const RayStats & s);
+
+  /// Counters of the calling thread
+  static RayStats & local ();
+
+  /// Sum of the counters of all threads, which are reset. No query may be running.
+  static RayStats collect ();
+
+  /// One line report, counts divided by numFrames and per ray averages
+  void print (std::ostream & out, unsigned int numFrames = 1) const;
+};
+
+/// Counts one ray query in local variables, added to the thread counters at its end
+class RayQuery {
+ public:
+  inline RayQuery () : hit (0), triangleTests (0), nodesVisited (0), earlyOuts (0) {}
+  inline ~RayQuery () {
+    RayStats & s = RayStats::local ();
+    s.rays++;
+    s.hits += hit;
+    s.triangleTests += triangleTests;
+    s.nodesVisited += nodesVisited;
+    s.earlyOuts += earlyOuts;
+  }
+
+  unsigned int hit;
+  unsigned int triangleTests;
+  unsigned int nodesVisited;
+  unsigned int earlyOuts;
+};
+
+#endif
@@ -0,0 +1,101 @@
+#include "Renderer.h"
+#include "Shading.h"
+#include "Parallel.h"
+#include "Profiler.h"
+#include <fstream>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+void Renderer::render (const Mesh & mesh, const BVH & bvh, Camera & camera, vector<Vec3f> & image) const {
+  renderMesh (mesh, bvh, camera, image);
+}
+
+void Renderer::render (const CompactMesh & mesh, const BVH & bvh, Camera & camera, vector<Vec3f> & image) const {
+  renderMesh (mesh, bvh, camera, image);
+}
+
+template <class MeshType>
+void Renderer::renderMesh (const MeshType & mesh, const BVH & bvh, Camera & camera, vector<Vec3f> & image) const {
+  image.assign (width * height, Vec3f (0.0f, 0.0f, 0.0f));
+  Vec3f eye, right, up, back;
+  camera.getFrame (eye, right, up, back);
+  float tanHalfFov = tan (camera.getFovAngle () * float (M_PI) / 360.0f);
+  float aspect = camera.getAspectRatio ();
+  BRDFFunction evaluate = brdfFunction (brdf);
+
+  unsigned int tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+  unsigned int tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+  parallelFor (tilesX * tilesY, 1, [&] (unsigned int begin, unsigned int end) {
+    PROFILE_ZONE ("render tile");
+    for (unsigned int tile = begin; tile < end; tile++) {
+      unsigned int x0 = (tile % tilesX) * TILE_SIZE, y0 = (tile / tilesX) * TILE_SIZE;
+      for (unsigned int y = y0; y < min (y0 + TILE_SIZE, height); y++)
+        for (unsigned int x = x0; x < min (x0 + TILE_SIZE, width); x++) {
+          // Pixel centers, image rows from top to bottom
+          float sx = (2.0f * (x + 0.5f) / width - 1.0f) * tanHalfFov * aspect;
+          float sy = (1.0f - 2.0f * (y + 0.5f) / height) * tanHalfFov;
+          Vec3f target = eye + right * sx + up * sy - back;
+          Ray ray (eye[0], eye[1], eye[2], target[0], target[1], target[2]);
+          image[y * width + x] = shade (mesh, bvh, evaluate, ray, eye);
+        }
+    }
+  });
+}
+
+template <class MeshType>
+Vec3f Renderer::shade (const MeshType & mesh, const BVH & bvh, BRDFFunction evaluate, Ray & ray, const Vec3f & eye) const {
+  float t;
+  int k = bvh.closestHit (ray, mesh, NO_VERTEX, t);
+  if (k < 0)
+    return Vec3f (0.0f, 0.0f, 0.0f);
+  unsigned int v[3];
+  mesh.triangle (k, v);
+  const Vec3f & p0 = mesh.position (v[0]);
+  const Vec3f & p1 = mesh.position (v[1]);
+  const Vec3f & p2 = mesh.position (v[2]);
+  Vec3f p = ray.origin + t * ray.direction;
+
+  // Barycentric coordinates of the hit point, to interpolate the vertex normals
+  Vec3f geometric = cross (p1 - p0, p2 - p0);
+  float area = dot (geometric, geometric);
+  float b1 = dot (cross (p - p0, p2 - p0), geometric) / area;
+  float b2 = dot (cross (p1 - p0, p - p0), geometric) / area;
+  float b0 = 1.0f - b1 - b2;
+  Vec3f n = b0 * mesh.normal (v[0]) + b1 * mesh.normal (v[1]) + b2 * mesh.normal (v[2]);
+  n.normalize ();
+
+  if (shadows) {
+    // Leave the surface slightly, the culling of Ray::intersect handles the rest
+    geometric.normalize ();
+    Vec3f o = p + 1e-4f * geometric;
+    Ray shadow (o[0], o[1], o[2], light[0], light[1], light[2]);
+    if (bvh.anyHit (shadow, mesh, NO_VERTEX))
+      return Vec3f (0.0f, 0.0f, 0.0f);
+  }
+
+  float c = evaluate (p, n, light, eye);
+  if (!vertexWeights.empty ())
+    c *= b0 * vertexWeights[v[0]] + b1 * vertexWeights[v[1]] + b2 * vertexWeights[v[2]];
+  return Vec3f (c, c, c);
+}
+
+bool Renderer::writePPM (const string & filename, unsigned int width, unsigned int height,
+                         const vector<Vec3f> & image) {
+  ofstream out (filename.c_str (), ios::binary);
+  if (!out)
+    return false;
+  out << "P6\n" << width << " " << height << "\n255\n";
+  vector<unsigned char> row (3 * width);
+  for (unsigned int y = 0; y < height; y++) {
+    for (unsigned int x = 0; x < width; x++)
+      for (unsigned int k = 0; k < 3; k++) {
+        float c = image[y * width + x][k];
+        // NaNs (e.g. from Blinn-Phong at grazing angles) come out black
+        row[3*x + k] = (unsigned char) (c > 0.0f ? min (c, 1.0f) * 255.0f + 0.5f : 0.0f);
+      }
+    out.write ((const char *) &row[0], row.size ());
+  }
+  return bool (out);
+}
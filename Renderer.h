@@ -0,0 +1,44 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <string>
+#include <vector>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "BVH.h"
+#include "CompactMesh.h"
+#include "Camera.h"
+#include "Shading.h"
+
+/// Offline ray tracer: casts one primary ray per pixel through the BVH and
+/// shades the hit points with the BRDFs of Shading.h and shadow rays, without
+/// any OpenGL context. The image is computed in tiles on the thread pool.
+class Renderer {
+ public:
+  Renderer () : width (1024), height (768), brdf (0), shadows (true), light (0.0f, 1.0f, 0.0f) {}
+
+  unsigned int width, height;
+  int brdf;                       // one of BRDF_*
+  bool shadows;
+  Vec3f light;
+  /// Optional per-vertex attenuation (e.g. ambient occlusion), interpolated over the triangles
+  std::vector<float> vertexWeights;
+
+  /// Renders the mesh seen from the camera (projection from its fovAngle and aspectRatio)
+  void render (const Mesh & mesh, const BVH & bvh, Camera & camera, std::vector<Vec3f> & image) const;
+  /// The same from a compact mesh, with a hierarchy built by BVH::build (const CompactMesh &)
+  void render (const CompactMesh & mesh, const BVH & bvh, Camera & camera, std::vector<Vec3f> & image) const;
+
+  /// Writes an image as a binary PPM file
+  static bool writePPM (const std::string & filename, unsigned int width, unsigned int height,
+                        const std::vector<Vec3f> & image);
+
+ private:
+  static const unsigned int TILE_SIZE = 16;
+  template <class MeshType>
+  void renderMesh (const MeshType & mesh, const BVH & bvh, Camera & camera, std::vector<Vec3f> & image) const;
+  template <class MeshType>
+  Vec3f shade (const MeshType & mesh, const BVH & bvh, BRDFFunction evaluate, Ray & ray, const Vec3f & eye) const;
+};
+
+#endif
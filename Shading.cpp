@@ -0,0 +1,63 @@
+#include "Shading.h"
+#include <iostream>
+
+using namespace std;
+
+namespace {
+  template <class BRDF>
+  void evaluateBRDFRange (const Vec3<float> * positions, const Vec3<float> * normals,
+                          const Vec3<float> & light, const Vec3<float> & camera,
+                          unsigned int begin, unsigned int end, float * out) {
+    for (unsigned int i = begin; i < end; i++)
+      out[i] = evaluateBRDF<BRDF> (positions[i], normals[i], light, camera);
+  }
+
+  template <class BRDF>
+  float specularTerm (const Vec3<float> & p, const Vec3<float> & n,
+                      const Vec3<float> & light, const Vec3<float> & camera) {
+    Vec3<float> nn = normalize (n);
+    Vec3<float> l = normalize (light - p);
+    return BRDF::specular (nn, l, normalize (camera - p)) * dot (nn, l);
+  }
+}
+
+BRDFFunction brdfFunction (int brdf) {
+  switch (brdf) {
+  case BRDF_COOK_TORRANCE:
+    return evaluateBRDF<CookTorrance>;
+  case BRDF_GGX:
+    return evaluateBRDF<GGX>;
+  default:
+    return evaluateBRDF<BlinnPhong>;
+  }
+}
+
+BRDFKernel brdfKernel (int brdf) {
+  switch (brdf) {
+  case BRDF_COOK_TORRANCE:
+    return evaluateBRDFRange<CookTorrance>;
+  case BRDF_GGX:
+    return evaluateBRDFRange<GGX>;
+  default:
+    return evaluateBRDFRange<BlinnPhong>;
+  }
+}
+
+float evaluateDiffuse (const Vec3<float> & p, const Vec3<float> & n, const Vec3<float> & light) {
+  return Lambert::KD_OVER_PI * dot (normalize (n), normalize (light - p));
+}
+
+float evaluateSpecular (int brdf, const Vec3<float> & p, const Vec3<float> & n,
+                        const Vec3<float> & light, const Vec3<float> & camera) {
+  switch (brdf) {
+  case BRDF_BLINN_PHONG:
+    return specularTerm<BlinnPhong> (p, n, light, camera);
+  case BRDF_COOK_TORRANCE:
+    return specularTerm<CookTorrance> (p, n, light, camera);
+  case BRDF_GGX:
+    return specularTerm<GGX> (p, n, light, camera);
+  default:
+    std::cerr << "BRDF: ERROR" << std::endl;
+    return 0.0f;
+  }
+}
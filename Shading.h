@@ -0,0 +1,126 @@
+#ifndef SHADING_H
+#define SHADING_H
+
+#include <cmath>
+#include <algorithm>
+#include "Vec3.h"
+
+#define BRDF_BLINN_PHONG 0
+#define BRDF_COOK_TORRANCE 1
+#define BRDF_GGX 2
+
+// BRDF policies: the specular term for the unit normal n, light direction l and
+// view direction v. The material parameters are compile-time constants, so that
+// their powers are folded in each instantiation of the kernels below.
+
+/// Lambertian diffuse term, common to all the BRDFs
+class Lambert {
+ public:
+  static constexpr float KD = 0.7f;
+  static constexpr float KD_OVER_PI = KD / 3.14f;
+};
+
+class BlinnPhong {
+ public:
+  static constexpr float KS = 0.5f;
+  static constexpr float S = 0.5f;   // exponent, pow (x, 0.5) is sqrt (x)
+
+  static inline float specular (const Vec3<float> & n, const Vec3<float> & l, const Vec3<float> & v) {
+    Vec3<float> r = 2.0f * n * dot (n, l) - l;
+    return KS * std::sqrt (dot (r, v));
+  }
+};
+
+/// Schlick's approximation of the Fresnel term, for CookTorrance and GGX
+template <int F0_PERCENT>
+class Schlick {
+ public:
+  static constexpr float F0 = F0_PERCENT / 100.0f;
+  static inline float fresnel (float lh) {
+    float x = 1.0f - std::max (0.0f, lh);
+    float x2 = x * x;
+    return F0 + (1.0f - F0) * (x2 * x2 * x);
+  }
+};
+
+class CookTorrance : public Schlick<4> {
+ public:
+  static constexpr float ALPHA = 0.7f;
+  static constexpr float ALPHA2 = ALPHA * ALPHA;
+
+  /// Beckmann distribution
+  static inline float distribution (float nh) {
+    float nh2 = nh * nh;
+    return std::exp ((nh2 - 1.0f) / (ALPHA2 * nh2)) / (3.14f * ALPHA2 * nh2 * nh2);
+  }
+
+  static inline float specular (const Vec3<float> & n, const Vec3<float> & l, const Vec3<float> & v) {
+    Vec3<float> h = l + v;
+    h.normalize ();
+    float nh = dot (n, h), nl = dot (n, l), nv = dot (n, v), vh = dot (v, h);
+    float D = distribution (nh);
+    float G = std::min (std::min (1.0f, 2.0f * nh * nl / vh), 2.0f * nh * nv / vh);
+    return D * fresnel (dot (l, h)) * G / (4.0f * nl * nv);
+  }
+};
+
+class GGX : public Schlick<4> {
+ public:
+  static constexpr float ALPHA = 0.7f;
+  static constexpr float ALPHA2 = ALPHA * ALPHA;
+
+  static inline float distribution (float nh) {
+    float d = 1.0f + (ALPHA2 - 1.0f) * nh * nh;
+    return ALPHA2 / 3.14f / (d * d);
+  }
+
+  /// Gi Go / (4 nl nv) below is visibility (nl) visibility (nv)
+  static inline float visibility (float x) {
+    return 1.0f / (x + std::sqrt (ALPHA2 + (1.0f - ALPHA2) * x * x));
+  }
+
+  static inline float specular (const Vec3<float> & n, const Vec3<float> & l, const Vec3<float> & v) {
+    Vec3<float> h = l + v;
+    h.normalize ();
+    float nh = dot (n, h), nl = dot (n, l), nv = dot (n, v);
+    float D = distribution (nh);
+    // As in the original drawScene, the denominator of the view term divides Gi
+    float Gi = 2.0f * nl / (nl + std::sqrt (ALPHA2 + (1.0f - ALPHA2) * nl * nl))
+      / (nv + std::sqrt (ALPHA2 + (1.0f - ALPHA2) * nv * nv));
+    float Go = 2.0f * nv;
+    return D * fresnel (dot (l, h)) * Gi * Go / (4.0f * nl * nv);
+  }
+};
+
+/// Diffuse plus specular BRDF at the point p of normal n lit by a point light
+/// and seen from camera, weighted by the cosine with the light direction
+template <class BRDF>
+inline float evaluateBRDF (const Vec3<float> & p, const Vec3<float> & n,
+                           const Vec3<float> & light, const Vec3<float> & camera) {
+  Vec3<float> nn = normalize (n);
+  Vec3<float> l = normalize (light - p);
+  Vec3<float> v = normalize (camera - p);
+  return (Lambert::KD_OVER_PI + BRDF::specular (nn, l, v)) * dot (nn, l);
+}
+
+/// evaluateBRDF of one of the BRDF_*, chosen once (e.g. per frame or per image)
+typedef float (*BRDFFunction) (const Vec3<float> & p, const Vec3<float> & n,
+                               const Vec3<float> & light, const Vec3<float> & camera);
+BRDFFunction brdfFunction (int brdf);
+
+/// evaluateBRDF for the vertices [begin, end) of the arrays, into out[begin, end)
+typedef void (*BRDFKernel) (const Vec3<float> * positions, const Vec3<float> * normals,
+                            const Vec3<float> & light, const Vec3<float> & camera,
+                            unsigned int begin, unsigned int end, float * out);
+BRDFKernel brdfKernel (int brdf);
+
+/// Diffuse part of the BRDF at the point p of normal n lit by a point light,
+/// weighted by the cosine with the light direction
+float evaluateDiffuse (const Vec3<float> & p, const Vec3<float> & n, const Vec3<float> & light);
+
+/// Specular part of the BRDF (one of BRDF_*) at the point p of normal n lit by
+/// a point light and seen from camera, weighted by the cosine with the light direction
+float evaluateSpecular (int brdf, const Vec3<float> & p, const Vec3<float> & n,
+                        const Vec3<float> & light, const Vec3<float> & camera);
+
+#endif
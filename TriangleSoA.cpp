@@ -0,0 +1,206 @@
+#include "TriangleSoA.h"
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_KERNELS
+#endif
+
+using namespace std;
+
+void TriangleSoA::build (const Mesh & mesh, const vector<unsigned int> & order) {
+  numTriangles = order.size ();
+  unsigned int padded = numTriangles + PACKET_SIZE;
+  for (int k = 0; k < 3; k++) {
+    v0[k].assign (padded, 0.0f);
+    e0[k].assign (padded, 0.0f);
+    e1[k].assign (padded, 0.0f);
+    n[k].assign (padded, 0.0f);
+    vertex[k].assign (padded, NO_VERTEX);
+  }
+  epsilon.assign (padded, 0.0f);
+  for (unsigned int i = 0; i < numTriangles; i++) {
+    const TriangleRecord & r = mesh.records[order[i]];
+    epsilon[i] = r.epsilon;
+    for (int k = 0; k < 3; k++) {
+      v0[k][i] = r.v0[k];
+      e0[k][i] = r.e0[k];
+      e1[k][i] = r.e1[k];
+      n[k][i] = r.n[k];
+      vertex[k][i] = r.v[k];
+    }
+  }
+}
+
+size_t TriangleSoA::memoryBytes () const {
+  size_t bytes = epsilon.capacity () * sizeof (float);
+  for (int k = 0; k < 3; k++)
+    bytes += (v0[k].capacity () + e0[k].capacity () + e1[k].capacity () + n[k].capacity ()) * sizeof (float)
+      + vertex[k].capacity () * sizeof (unsigned int);
+  return bytes;
+}
+
+namespace {
+  unsigned int intersectScalar (const TriangleSoA & tri, unsigned int first, unsigned int count,
+                                const Ray & ray, unsigned int source, float * t) {
+    const float ox = ray.origin[0], oy = ray.origin[1], oz = ray.origin[2];
+    const float dx = ray.direction[0], dy = ray.direction[1], dz = ray.direction[2];
+    unsigned int mask = 0;
+    for (unsigned int j = 0; j < count; j++) {
+      unsigned int i = first + j;
+      if (tri.vertex[0][i] == source || tri.vertex[1][i] == source || tri.vertex[2][i] == source)
+        continue;
+      float e0x = tri.e0[0][i], e0y = tri.e0[1][i], e0z = tri.e0[2][i];
+      float e1x = tri.e1[0][i], e1y = tri.e1[1][i], e1z = tri.e1[2][i];
+      float qx = dy * e1z - dz * e1y;
+      float qy = dz * e1x - dx * e1z;
+      float qz = dx * e1y - dy * e1x;
+      float a = e0x * qx + e0y * qy + e0z * qz;
+      float nd = tri.n[0][i] * dx + tri.n[1][i] * dy + tri.n[2][i] * dz;
+      if ((nd >= 0) || (a * a < tri.epsilon[i]))
+        continue;
+      float sx = (ox - tri.v0[0][i]) / a;
+      float sy = (oy - tri.v0[1][i]) / a;
+      float sz = (oz - tri.v0[2][i]) / a;
+      float rx = sy * e0z - sz * e0y;
+      float ry = sz * e0x - sx * e0z;
+      float rz = sx * e0y - sy * e0x;
+      float b0 = sx * qx + sy * qy + sz * qz;
+      float b1 = rx * dx + ry * dy + rz * dz;
+      float b2 = 1 - b0 - b1;
+      if ((b0 < 0) || (b1 < 0) || (b2 < 0))
+        continue;
+      float tj = e1x * rx + e1y * ry + e1z * rz;
+      if (tj >= 0) {
+        t[j] = tj;
+        mask |= 1u << j;
+      }
+    }
+    return mask;
+  }
+
+#ifdef HAS_X86_KERNELS
+  unsigned int intersectSSE2 (const TriangleSoA & tri, unsigned int first, unsigned int count,
+                              const Ray & ray, unsigned int source, float * t) {
+    const __m128 ox = _mm_set1_ps (ray.origin[0]), oy = _mm_set1_ps (ray.origin[1]), oz = _mm_set1_ps (ray.origin[2]);
+    const __m128 dx = _mm_set1_ps (ray.direction[0]), dy = _mm_set1_ps (ray.direction[1]), dz = _mm_set1_ps (ray.direction[2]);
+    const __m128 zero = _mm_setzero_ps (), one = _mm_set1_ps (1.0f);
+    const __m128i src = _mm_set1_epi32 (source);
+    unsigned int mask = 0;
+    for (unsigned int j = 0; j < count; j += 4) {
+      unsigned int i = first + j;
+      __m128 e0x = _mm_loadu_ps (&tri.e0[0][i]), e0y = _mm_loadu_ps (&tri.e0[1][i]), e0z = _mm_loadu_ps (&tri.e0[2][i]);
+      __m128 e1x = _mm_loadu_ps (&tri.e1[0][i]), e1y = _mm_loadu_ps (&tri.e1[1][i]), e1z = _mm_loadu_ps (&tri.e1[2][i]);
+      __m128 qx = _mm_sub_ps (_mm_mul_ps (dy, e1z), _mm_mul_ps (dz, e1y));
+      __m128 qy = _mm_sub_ps (_mm_mul_ps (dz, e1x), _mm_mul_ps (dx, e1z));
+      __m128 qz = _mm_sub_ps (_mm_mul_ps (dx, e1y), _mm_mul_ps (dy, e1x));
+      __m128 a = _mm_add_ps (_mm_add_ps (_mm_mul_ps (e0x, qx), _mm_mul_ps (e0y, qy)), _mm_mul_ps (e0z, qz));
+      __m128 nd = _mm_add_ps (_mm_add_ps (_mm_mul_ps (_mm_loadu_ps (&tri.n[0][i]), dx),
+                                          _mm_mul_ps (_mm_loadu_ps (&tri.n[1][i]), dy)),
+                              _mm_mul_ps (_mm_loadu_ps (&tri.n[2][i]), dz));
+      __m128 reject = _mm_or_ps (_mm_cmpge_ps (nd, zero), _mm_cmplt_ps (_mm_mul_ps (a, a), _mm_loadu_ps (&tri.epsilon[i])));
+      __m128 sx = _mm_div_ps (_mm_sub_ps (ox, _mm_loadu_ps (&tri.v0[0][i])), a);
+      __m128 sy = _mm_div_ps (_mm_sub_ps (oy, _mm_loadu_ps (&tri.v0[1][i])), a);
+      __m128 sz = _mm_div_ps (_mm_sub_ps (oz, _mm_loadu_ps (&tri.v0[2][i])), a);
+      __m128 rx = _mm_sub_ps (_mm_mul_ps (sy, e0z), _mm_mul_ps (sz, e0y));
+      __m128 ry = _mm_sub_ps (_mm_mul_ps (sz, e0x), _mm_mul_ps (sx, e0z));
+      __m128 rz = _mm_sub_ps (_mm_mul_ps (sx, e0y), _mm_mul_ps (sy, e0x));
+      __m128 b0 = _mm_add_ps (_mm_add_ps (_mm_mul_ps (sx, qx), _mm_mul_ps (sy, qy)), _mm_mul_ps (sz, qz));
+      __m128 b1 = _mm_add_ps (_mm_add_ps (_mm_mul_ps (rx, dx), _mm_mul_ps (ry, dy)), _mm_mul_ps (rz, dz));
+      __m128 b2 = _mm_sub_ps (_mm_sub_ps (one, b0), b1);
+      __m128 tj = _mm_add_ps (_mm_add_ps (_mm_mul_ps (e1x, rx), _mm_mul_ps (e1y, ry)), _mm_mul_ps (e1z, rz));
+      // "not less than" comparisons keep NaNs, as the scalar code does
+      __m128 hit = _mm_and_ps (_mm_and_ps (_mm_cmpnlt_ps (b0, zero), _mm_cmpnlt_ps (b1, zero)),
+                               _mm_and_ps (_mm_cmpnlt_ps (b2, zero), _mm_cmpge_ps (tj, zero)));
+      hit = _mm_andnot_ps (reject, hit);
+      __m128i self = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi32 (_mm_loadu_si128 ((const __m128i *) &tri.vertex[0][i]), src),
+                                                 _mm_cmpeq_epi32 (_mm_loadu_si128 ((const __m128i *) &tri.vertex[1][i]), src)),
+                                   _mm_cmpeq_epi32 (_mm_loadu_si128 ((const __m128i *) &tri.vertex[2][i]), src));
+      hit = _mm_andnot_ps (_mm_castsi128_ps (self), hit);
+      _mm_storeu_ps (t + j, tj);
+      mask |= (unsigned int) _mm_movemask_ps (hit) << j;
+    }
+    return mask & ((1u << count) - 1);
+  }
+
+  __attribute__ ((target ("avx2")))
+  unsigned int intersectAVX2 (const TriangleSoA & tri, unsigned int first, unsigned int count,
+                              const Ray & ray, unsigned int source, float * t) {
+    const __m256 ox = _mm256_set1_ps (ray.origin[0]), oy = _mm256_set1_ps (ray.origin[1]), oz = _mm256_set1_ps (ray.origin[2]);
+    const __m256 dx = _mm256_set1_ps (ray.direction[0]), dy = _mm256_set1_ps (ray.direction[1]), dz = _mm256_set1_ps (ray.direction[2]);
+    const __m256 zero = _mm256_setzero_ps (), one = _mm256_set1_ps (1.0f);
+    const __m256i src = _mm256_set1_epi32 (source);
+    unsigned int i = first;
+    __m256 e0x = _mm256_loadu_ps (&tri.e0[0][i]), e0y = _mm256_loadu_ps (&tri.e0[1][i]), e0z = _mm256_loadu_ps (&tri.e0[2][i]);
+    __m256 e1x = _mm256_loadu_ps (&tri.e1[0][i]), e1y = _mm256_loadu_ps (&tri.e1[1][i]), e1z = _mm256_loadu_ps (&tri.e1[2][i]);
+    __m256 qx = _mm256_sub_ps (_mm256_mul_ps (dy, e1z), _mm256_mul_ps (dz, e1y));
+    __m256 qy = _mm256_sub_ps (_mm256_mul_ps (dz, e1x), _mm256_mul_ps (dx, e1z));
+    __m256 qz = _mm256_sub_ps (_mm256_mul_ps (dx, e1y), _mm256_mul_ps (dy, e1x));
+    __m256 a = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (e0x, qx), _mm256_mul_ps (e0y, qy)), _mm256_mul_ps (e0z, qz));
+    __m256 nd = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (_mm256_loadu_ps (&tri.n[0][i]), dx),
+                                              _mm256_mul_ps (_mm256_loadu_ps (&tri.n[1][i]), dy)),
+                               _mm256_mul_ps (_mm256_loadu_ps (&tri.n[2][i]), dz));
+    __m256 reject = _mm256_or_ps (_mm256_cmp_ps (nd, zero, _CMP_GE_OQ),
+                                  _mm256_cmp_ps (_mm256_mul_ps (a, a), _mm256_loadu_ps (&tri.epsilon[i]), _CMP_LT_OQ));
+    __m256 sx = _mm256_div_ps (_mm256_sub_ps (ox, _mm256_loadu_ps (&tri.v0[0][i])), a);
+    __m256 sy = _mm256_div_ps (_mm256_sub_ps (oy, _mm256_loadu_ps (&tri.v0[1][i])), a);
+    __m256 sz = _mm256_div_ps (_mm256_sub_ps (oz, _mm256_loadu_ps (&tri.v0[2][i])), a);
+    __m256 rx = _mm256_sub_ps (_mm256_mul_ps (sy, e0z), _mm256_mul_ps (sz, e0y));
+    __m256 ry = _mm256_sub_ps (_mm256_mul_ps (sz, e0x), _mm256_mul_ps (sx, e0z));
+    __m256 rz = _mm256_sub_ps (_mm256_mul_ps (sx, e0y), _mm256_mul_ps (sy, e0x));
+    __m256 b0 = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (sx, qx), _mm256_mul_ps (sy, qy)), _mm256_mul_ps (sz, qz));
+    __m256 b1 = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (rx, dx), _mm256_mul_ps (ry, dy)), _mm256_mul_ps (rz, dz));
+    __m256 b2 = _mm256_sub_ps (_mm256_sub_ps (one, b0), b1);
+    __m256 tj = _mm256_add_ps (_mm256_add_ps (_mm256_mul_ps (e1x, rx), _mm256_mul_ps (e1y, ry)), _mm256_mul_ps (e1z, rz));
+    __m256 hit = _mm256_and_ps (_mm256_and_ps (_mm256_cmp_ps (b0, zero, _CMP_NLT_UQ), _mm256_cmp_ps (b1, zero, _CMP_NLT_UQ)),
+                                _mm256_and_ps (_mm256_cmp_ps (b2, zero, _CMP_NLT_UQ), _mm256_cmp_ps (tj, zero, _CMP_GE_OQ)));
+    hit = _mm256_andnot_ps (reject, hit);
+    __m256i self = _mm256_or_si256 (_mm256_or_si256 (_mm256_cmpeq_epi32 (_mm256_loadu_si256 ((const __m256i *) &tri.vertex[0][i]), src),
+                                                     _mm256_cmpeq_epi32 (_mm256_loadu_si256 ((const __m256i *) &tri.vertex[1][i]), src)),
+                                    _mm256_cmpeq_epi32 (_mm256_loadu_si256 ((const __m256i *) &tri.vertex[2][i]), src));
+    hit = _mm256_andnot_ps (_mm256_castsi256_ps (self), hit);
+    _mm256_storeu_ps (t, tj);
+    return (unsigned int) _mm256_movemask_ps (hit) & ((1u << count) - 1);
+  }
+#endif
+
+  PacketIntersectFunction detectKernel () {
+#ifdef HAS_X86_KERNELS
+    __builtin_cpu_init ();
+    if (__builtin_cpu_supports ("avx2"))
+      return intersectAVX2;
+    return intersectSSE2;
+#else
+    return intersectScalar;
+#endif
+  }
+}
+
+PacketIntersectFunction intersectPacket = detectKernel ();
+
+const char * packetKernelName () {
+#ifdef HAS_X86_KERNELS
+  if (intersectPacket == intersectAVX2)
+    return "avx2";
+  if (intersectPacket == intersectSSE2)
+    return "sse2";
+#endif
+  return "scalar";
+}
+
+bool selectPacketKernel (const char * name) {
+  if (strcmp (name, "scalar") == 0) {
+    intersectPacket = intersectScalar;
+    return true;
+  }
+#ifdef HAS_X86_KERNELS
+  if (strcmp (name, "sse2") == 0) {
+    intersectPacket = intersectSSE2;
+    return true;
+  }
+  if (strcmp (name, "avx2") == 0 && __builtin_cpu_supports ("avx2")) {
+    intersectPacket = intersectAVX2;
+    return true;
+  }
+#endif
+  return false;
+}
@@ -0,0 +1,61 @@
+#ifndef TRIANGLE_SOA_H
+#define TRIANGLE_SOA_H
+
+#include <vector>
+#include "Vec3.h"
+#include "Mesh.h"
+#include "Ray.h"
+#include "Aligned.h"
+
+/// Structure-of-arrays copy of the triangles of a mesh, holding the terms of
+/// Ray::intersect which do not depend on the ray (first vertex, edges, unit
+/// normal and parallel ray threshold), for the packet intersection kernels.
+/// The arrays are padded so that a packet of PACKET_SIZE triangles can always
+/// be loaded.
+class TriangleSoA {
+ public:
+  static const unsigned int PACKET_SIZE = 8;
+
+  typedef std::vector<float, AlignedAllocator<float> > FloatArray;
+  typedef std::vector<unsigned int, AlignedAllocator<unsigned int> > IndexArray;
+
+  FloatArray v0[3];
+  FloatArray e0[3];
+  FloatArray e1[3];
+  FloatArray n[3];
+  FloatArray epsilon;    // threshold on the squared determinant
+  IndexArray vertex[3];  // vertex indices, for the self-hit policy
+
+  TriangleSoA () : numTriangles (0) {}
+
+  /// Copies the triangles mesh.T[order[i]] in that order
+  void build (const Mesh & mesh, const std::vector<unsigned int> & order);
+
+  inline unsigned int size () const { return numTriangles; }
+
+  /// Bytes of the arrays
+  size_t memoryBytes () const;
+
+ private:
+  unsigned int numTriangles;
+};
+
+/// Tests a ray against the triangles [first, first + count) of the arrays, with
+/// count <= TriangleSoA::PACKET_SIZE, skipping the triangles incident to the
+/// vertex 'source'. Returns the mask of the triangles hit (bit i for triangle
+/// first + i), with the hit distances in t[i] (t holds PACKET_SIZE floats).
+/// The hits are exactly those of Ray::intersect.
+typedef unsigned int (*PacketIntersectFunction) (const TriangleSoA & triangles, unsigned int first,
+                                                 unsigned int count, const Ray & ray, unsigned int source,
+                                                 float * t);
+
+/// Kernel selected at startup for this CPU (AVX2, SSE2 or scalar)
+extern PacketIntersectFunction intersectPacket;
+
+/// Name of the kernel in use
+const char * packetKernelName ();
+
+/// Forces a kernel ("avx2", "sse2" or "scalar"), returns false if it is not available
+bool selectPacketKernel (const char * name);
+
+#endif
@@ -34,11 +34,8 @@ public:
 	p[2] = p2; 
   };
 
-  inline Vec3 (const Vec3 & v) {
-	init (v[0], v[1], v[2]);
-  }
-  
-  ~Vec3() {}
+  // Copies and destruction are the implicit ones: Vec3 is trivially copyable, so
+  // arrays of vectors can be copied with memcpy and shared with OpenGL
 
   inline Vec3 (T* pp) { 
 	p[0] = pp[0];
@@ -58,13 +55,6 @@ public:
 	return (p[Index]);
   };
 
-  inline Vec3& operator= (const Vec3 & P) {
-	p[0] = P[0];
-	p[1] = P[1];
-	p[2] = P[2];
-	return (*this);
-  };
-
   inline Vec3& operator+= (const Vec3 & P) {
 	p[0] += P[0];
 	p[1] += P[1];
@@ -264,6 +254,17 @@ inline Vec3<T> cross (const Vec3<T> & a, const Vec3<T> & b) {
       return r;
 }
 
+/// Component-wise minimum and maximum
+template <class T>
+inline Vec3<T> componentMin (const Vec3<T> & a, const Vec3<T> & b) {
+      return Vec3<T> (a[0] < b[0] ? a[0] : b[0], a[1] < b[1] ? a[1] : b[1], a[2] < b[2] ? a[2] : b[2]);
+}
+
+template <class T>
+inline Vec3<T> componentMax (const Vec3<T> & a, const Vec3<T> & b) {
+      return Vec3<T> (a[0] > b[0] ? a[0] : b[0], a[1] > b[1] ? a[1] : b[1], a[2] > b[2] ? a[2] : b[2]);
+}
+
 template <class T>
 inline Vec3<T> normalize (const Vec3<T> & x) {
     Vec3<T> n (x);
@@ -351,6 +352,11 @@ std::istream & operator>> (std::istream & input, Vec3<T> & v) {
   return input;
 }
 
+// Compile-time switch to the SSE version of Vec3<float>
+#if defined(VEC3_SIMD) && defined(__SSE2__)
+#include "Vec3SIMD.h"
+#endif
+
 typedef Vec3<float> Vec3f;
 typedef Vec3<double> Vec3d;
 typedef Vec3<int> Vec3i;
@@ -0,0 +1,135 @@
+// SSE specialization of Vec3<float>, included by Vec3.h when VEC3_SIMD is
+// defined (make VEC3_SIMD=1). The vector is padded to 16 bytes and kept in a
+// single register; the 4th component is ignored (comparisons and dot products
+// only read the first 3).
+//
+// The results are the same as the scalar template's: every component is
+// computed by the same operations in the same order (dot adds x, y then z,
+// no fused multiply-add), so that the rendering does not depend on the switch.
+// VEC3_FAST_RSQRT additionally makes normalize use the approximate reciprocal
+// square root, refined by one Newton step (about 22 bits, no longer exact).
+
+#ifndef VEC3_SIMD_H
+#define VEC3_SIMD_H
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+template <>
+class Vec3<float> {
+
+public:
+  inline Vec3 (void) : v (_mm_setzero_ps ()) {}
+  inline Vec3 (float p0, float p1, float p2) : v (_mm_set_ps (0.0f, p2, p1, p0)) {}
+  inline Vec3 (const float * pp) : v (_mm_set_ps (0.0f, pp[2], pp[1], pp[0])) {}
+  inline explicit Vec3 (__m128 v) : v (v) {}
+
+  inline float & operator[] (int Index) { return ((float *) &v)[Index]; }
+  inline const float & operator[] (int Index) const { return ((const float *) &v)[Index]; }
+  inline __m128 simd () const { return v; }
+
+  inline Vec3 & operator+= (const Vec3 & P) { v = _mm_add_ps (v, P.v); return (*this); }
+  inline Vec3 & operator-= (const Vec3 & P) { v = _mm_sub_ps (v, P.v); return (*this); }
+  inline Vec3 & operator*= (const Vec3 & P) { v = _mm_mul_ps (v, P.v); return (*this); }
+  inline Vec3 & operator*= (float s) { v = _mm_mul_ps (v, _mm_set1_ps (s)); return (*this); }
+  inline Vec3 & operator/= (const Vec3 & P) { v = _mm_div_ps (v, P.v); return (*this); }
+  inline Vec3 & operator/= (float s) { v = _mm_div_ps (v, _mm_set1_ps (s)); return (*this); }
+
+  inline Vec3 operator+ (const Vec3 & P) const { return Vec3 (_mm_add_ps (v, P.v)); }
+  inline Vec3 operator- (const Vec3 & P) const { return Vec3 (_mm_sub_ps (v, P.v)); }
+  inline Vec3 operator- () const { return Vec3 (_mm_xor_ps (v, _mm_set1_ps (-0.0f))); }
+  inline Vec3 operator* (const Vec3 & P) const { return Vec3 (_mm_mul_ps (v, P.v)); }
+  inline Vec3 operator* (float s) const { return Vec3 (_mm_mul_ps (v, _mm_set1_ps (s))); }
+  inline Vec3 operator/ (const Vec3 & P) const { return Vec3 (_mm_div_ps (v, P.v)); }
+  inline Vec3 operator/ (float s) const { return Vec3 (_mm_div_ps (v, _mm_set1_ps (s))); }
+
+  inline bool operator == (const Vec3 & a) const { return (_mm_movemask_ps (_mm_cmpeq_ps (v, a.v)) & 7) == 7; }
+  inline bool operator != (const Vec3 & a) const { return (_mm_movemask_ps (_mm_cmpneq_ps (v, a.v)) & 7) != 0; }
+  inline bool operator < (const Vec3 & a) const { return (_mm_movemask_ps (_mm_cmplt_ps (v, a.v)) & 7) == 7; }
+  inline bool operator >= (const Vec3 & a) const { return (_mm_movemask_ps (_mm_cmpge_ps (v, a.v)) & 7) == 7; }
+
+  inline Vec3 & init (float x, float y, float z) { v = _mm_set_ps (0.0f, z, y, x); return (*this); }
+
+  inline float squaredLength () const { return dot3 (v, v); }
+  inline float length () const { return (float) sqrt (squaredLength ()); }
+
+  /// Return length after normalization
+  inline float normalize (void) {
+#ifdef VEC3_FAST_RSQRT
+    float l2 = squaredLength ();
+    if (l2 == 0.0f)
+      return 0;
+    __m128 x = _mm_set_ss (l2);
+    __m128 r = _mm_rsqrt_ss (x);
+    // One Newton step: r * (1.5 - 0.5 x r^2)
+    r = _mm_mul_ss (r, _mm_sub_ss (_mm_set_ss (1.5f), _mm_mul_ss (_mm_mul_ss (_mm_set_ss (0.5f), x), _mm_mul_ss (r, r))));
+    v = _mm_mul_ps (v, _mm_shuffle_ps (r, r, 0));
+    return l2 * _mm_cvtss_f32 (r);
+#else
+    float l = length ();
+    if (l == 0.0f)
+      return 0;
+    float invL = 1.0f / l;
+    v = _mm_mul_ps (v, _mm_set1_ps (invL));
+    return l;
+#endif
+  }
+
+  inline void getTwoOrthogonals (Vec3 & u, Vec3 & w) const {
+    const float * p = (const float *) &v;
+    if (fabs (p[0]) < fabs (p[1])) {
+      if (fabs (p[0]) < fabs (p[2]))
+        u = Vec3 (0, -p[2], p[1]);
+      else
+        u = Vec3 (-p[1], p[0], 0);
+    } else {
+      if (fabs (p[1]) < fabs (p[2]))
+        u = Vec3 (p[2], 0, -p[0]);
+      else
+        u = Vec3 (-p[1], p[0], 0);
+    }
+    w = Vec3 (cross3 (v, u.v));
+  }
+
+  inline Vec3 projectOn (const Vec3 & N, const Vec3 & P) const {
+    float w = dot3 (_mm_sub_ps (v, P.v), N.v);
+    return (*this) - (N * w);
+  }
+
+  /// (a0 b0 + a1 b1) + a2 b2, the order of the scalar dot
+  static inline float dot3 (__m128 a, __m128 b) {
+    __m128 m = _mm_mul_ps (a, b);
+    __m128 s = _mm_add_ss (m, _mm_shuffle_ps (m, m, _MM_SHUFFLE (1, 1, 1, 1)));
+    return _mm_cvtss_f32 (_mm_add_ss (s, _mm_shuffle_ps (m, m, _MM_SHUFFLE (2, 2, 2, 2))));
+  }
+
+  /// a.yzx * b.zxy - a.zxy * b.yzx, component by component as the scalar cross
+  static inline __m128 cross3 (__m128 a, __m128 b) {
+    __m128 a1 = _mm_shuffle_ps (a, a, _MM_SHUFFLE (3, 0, 2, 1));
+    __m128 b1 = _mm_shuffle_ps (b, b, _MM_SHUFFLE (3, 1, 0, 2));
+    __m128 a2 = _mm_shuffle_ps (a, a, _MM_SHUFFLE (3, 1, 0, 2));
+    __m128 b2 = _mm_shuffle_ps (b, b, _MM_SHUFFLE (3, 0, 2, 1));
+    return _mm_sub_ps (_mm_mul_ps (a1, b1), _mm_mul_ps (a2, b2));
+  }
+
+private:
+  __m128 v;
+};
+
+inline float dot (const Vec3<float> & a, const Vec3<float> & b) {
+  return Vec3<float>::dot3 (a.simd (), b.simd ());
+}
+
+inline Vec3<float> cross (const Vec3<float> & a, const Vec3<float> & b) {
+  return Vec3<float> (Vec3<float>::cross3 (a.simd (), b.simd ()));
+}
+
+inline Vec3<float> componentMin (const Vec3<float> & a, const Vec3<float> & b) {
+  return Vec3<float> (_mm_min_ps (a.simd (), b.simd ()));
+}
+
+inline Vec3<float> componentMax (const Vec3<float> & a, const Vec3<float> & b) {
+  return Vec3<float> (_mm_max_ps (a.simd (), b.simd ()));
+}
+
+#endif